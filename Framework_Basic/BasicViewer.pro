@@ -16,7 +16,24 @@ HEADERS += \
     camera.h \
     sphere.h \
     light.h \
-    material.h
+    material.h \
+    transform.h \
+    quaternion.h \
+    fastmath.h \
+    scenegraph.h \
+    sceneloader.h \
+    framebuffers.h \
+    renderthread.h \
+    resolutioncontroller.h \
+    profiler.h \
+    tracewriter.h \
+    tileworker.h \
+    rasterizer.h \
+    bresenham.h \
+    overlay.h \
+    linemesh.h \
+    trianglemesh.h \
+    spherebvh.h
 
 SOURCES += glbox.cpp \
            main.cpp \
@@ -25,14 +42,40 @@ SOURCES += glbox.cpp \
     camera.cpp \
     sphere.cpp \
     light.cpp \
-    material.cpp
+    material.cpp \
+    fastmath.cpp \
+    scenegraph.cpp \
+    sceneloader.cpp \
+    framebuffers.cpp \
+    renderthread.cpp \
+    resolutioncontroller.cpp \
+    profiler.cpp \
+    tracewriter.cpp \
+    tileworker.cpp \
+    rasterizer.cpp \
+    bresenham.cpp \
+    overlay.cpp \
+    linemesh.cpp \
+    trianglemesh.cpp \
+    spherebvh.cpp
+
+OTHER_FILES += scenes/solar.scn
 
 INCLUDEPATH += . ui /usr/include /usr/local/include
 
 QMAKE_CXXFLAGS_RELEASE += -Wno-non-virtual-dtor 
 QMAKE_CXXFLAGS_DEBUG += -Wno-non-virtual-dtor 
+
+# Release builds use -O2, which does not vectorize loops before GCC 12 and then only with the
+# very cheap cost model; the triangle packets of trianglemesh.cpp rely on it.
+# The project builds in release mode, replace release by debug below for a debug build.
+QMAKE_CXXFLAGS_RELEASE += -ftree-vectorize
+
+# Use the approximations of fastmath.h for shading by default (toggle at runtime with 'F')
+#DEFINES += FAST_MATH
+
 CONFIG += opengl \
-	debug \
+	release \
         warn_on \
         qt \
 
@@ -0,0 +1,158 @@
+#include "bresenham.h"
+#include <math.h>
+#include <stdlib.h>
+
+// One Liang-Barsky boundary: p*t <= q
+static bool clipBoundary(double p, double q, double &t0, double &t1)
+{
+    if(p == 0)
+    {
+        return q >= 0;
+    }
+    double t = q / p;
+    if(p < 0)
+    {
+        if(t > t1) return false;
+        if(t > t0) t0 = t;
+    }
+    else
+    {
+        if(t < t0) return false;
+        if(t < t1) t1 = t;
+    }
+    return true;
+}
+
+// False for NaN and infinity, whose difference with themselves is NaN
+static inline bool isFinite(double x)
+{
+    return x - x == 0;
+}
+
+bool clipLine(double &x1, double &y1, double &x2, double &y2, double xmin, double ymin, double xmax, double ymax)
+{
+    //Degenerate projections (w = 0) give NaN or infinite end points, the boundary tests
+    //below would accept NaN and the callers would round it to INT_MIN
+    if(!isFinite(x1) || !isFinite(y1) || !isFinite(x2) || !isFinite(y2))
+    {
+        return false;
+    }
+
+    double dx = x2 - x1;
+    double dy = y2 - y1;
+    double t0 = 0;
+    double t1 = 1;
+    if(!clipBoundary(-dx, x1 - xmin, t0, t1) || !clipBoundary(dx, xmax - x1, t0, t1) ||
+       !clipBoundary(-dy, y1 - ymin, t0, t1) || !clipBoundary(dy, ymax - y1, t0, t1))
+    {
+        return false;
+    }
+
+    double sx = x1;
+    double sy = y1;
+    x1 = sx + t0*dx;
+    y1 = sy + t0*dy;
+    x2 = sx + t1*dx;
+    y2 = sy + t1*dy;
+    return true;
+}
+
+static inline void putPixel(unsigned char *pixel, const unsigned char color[3])
+{
+    pixel[0] = color[0];
+    pixel[1] = color[1];
+    pixel[2] = color[2];
+}
+
+void drawLine(const PixelBuffer &buffer, double x1, double y1, double x2, double y2, const unsigned char color[3])
+{
+    //The rounded end points stay inside the buffer
+    if(!clipLine(x1, y1, x2, y2, 0, 0, buffer.width - 1, buffer.height - 1))
+    {
+        return;
+    }
+    int ix1 = int(floor(x1 + 0.5));
+    int iy1 = int(floor(y1 + 0.5));
+    int ix2 = int(floor(x2 + 0.5));
+    int iy2 = int(floor(y2 + 0.5));
+
+    int dx = abs(ix2 - ix1);
+    int dy = abs(iy2 - iy1);
+    int stepX = ix2 >= ix1 ? 3 : -3;
+    int stepY = iy2 >= iy1 ? 3*buffer.stride : -3*buffer.stride;
+    unsigned char *pixel = buffer.data + 3*(iy1*buffer.stride + ix1);
+
+    //Step along the major axis, the decision variable chooses the minor steps
+    int major = dx >= dy ? stepX : stepY;
+    int minor = dx >= dy ? stepY : stepX;
+    int longDelta = dx >= dy ? dx : dy;
+    int shortDelta = dx >= dy ? dy : dx;
+    int d = 2*shortDelta - longDelta;
+    for(int i=0; i<=longDelta; i++)
+    {
+        putPixel(pixel, color);
+        if(d >= 0)
+        {
+            pixel += minor;
+            d -= 2*longDelta;
+        }
+        d += 2*shortDelta;
+        pixel += major;
+    }
+}
+
+void drawLines(const PixelBuffer &buffer, const double *points, int count, const unsigned char color[3])
+{
+    for(int i=0; i<count; i++, points += 4)
+    {
+        drawLine(buffer, points[0], points[1], points[2], points[3], color);
+    }
+}
+
+void drawCircle(const PixelBuffer &buffer, int cx, int cy, int radius, const unsigned char color[3])
+{
+    if(radius < 0 || cx + radius < 0 || cy + radius < 0 || cx - radius >= buffer.width || cy - radius >= buffer.height)
+    {
+        return;
+    }
+    //Only circles crossing the border need to test their pixels
+    bool inside = cx - radius >= 0 && cy - radius >= 0 && cx + radius < buffer.width && cy + radius < buffer.height;
+
+    int row = 3*buffer.stride;
+    unsigned char *center = buffer.data + 3*(cy*buffer.stride + cx);
+    int x = 0;
+    int y = radius;
+    int d = 5 - 4*radius;
+    while(true)
+    {
+        //The eight octant points (+-x, +-y) and (+-y, +-x)
+        int offsets[8][2] = {
+            { y,  x}, { x,  y}, {-x,  y}, {-y,  x},
+            {-y, -x}, {-x, -y}, { x, -y}, { y, -x}
+        };
+        for(int i=0; i<8; i++)
+        {
+            if(inside || (cx + offsets[i][0] >= 0 && cx + offsets[i][0] < buffer.width &&
+                          cy + offsets[i][1] >= 0 && cy + offsets[i][1] < buffer.height))
+            {
+                putPixel(center + 3*offsets[i][0] + row*offsets[i][1], color);
+            }
+        }
+
+        if(y <= x)
+        {
+            break;
+        }
+        if(d >= 0)
+        {
+            d += 4*(2*(x - y) + 5);
+            x++;
+            y--;
+        }
+        else
+        {
+            d += 4*(2*x + 3);
+            x++;
+        }
+    }
+}
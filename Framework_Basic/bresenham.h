@@ -0,0 +1,35 @@
+//
+// Bresenham
+//
+// Line and circle drawing into an RGB buffer. Primitives are clipped against the
+// buffer once up front (Liang-Barsky for lines, bounding box test for circles), so the
+// inner loops step a pixel pointer by constant strides without any per-pixel checks.
+// Coordinates are pixel positions in the buffer, i.e. [0, width) x [0, height).
+//
+
+#ifndef BRESENHAM_H
+#define BRESENHAM_H
+
+// Target of the drawing functions
+struct PixelBuffer
+{
+    unsigned char *data;    // RGB, 3 bytes per pixel
+    int width;
+    int height;
+    int stride;             // Pixels per row
+};
+
+// Clip the segment to the rectangle [xmin, xmax] x [ymin, ymax] (Liang-Barsky).
+// Returns false if the segment lies completely outside or an end point is not finite.
+bool clipLine(double &x1, double &y1, double &x2, double &y2, double xmin, double ymin, double xmax, double ymax);
+
+// Draw the line between two points with the given RGB color.
+void drawLine(const PixelBuffer &buffer, double x1, double y1, double x2, double y2, const unsigned char color[3]);
+
+// Draw count lines, segment i runs from points[4*i], points[4*i+1] to points[4*i+2], points[4*i+3].
+void drawLines(const PixelBuffer &buffer, const double *points, int count, const unsigned char color[3]);
+
+// Draw the outline of a circle with the given RGB color.
+void drawCircle(const PixelBuffer &buffer, int cx, int cy, int radius, const unsigned char color[3]);
+
+#endif // BRESENHAM_H
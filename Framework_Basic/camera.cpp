@@ -4,6 +4,7 @@
 
 Camera::Camera()
 {
+    m_focus = 1000;
     setUpVec(Vec4d(0,1,0,0));
     setViewVec(Vec4d(0,0,-1,0));
     setEyePoint(Vec4d(0,0,1,0));
@@ -14,6 +15,7 @@ void Camera::setViewVec(Vec4d viewVec)
     //Normalize
     double vecLength = sqrt(viewVec(0)*viewVec(0) + viewVec(1)*viewVec(1) + viewVec(2)*viewVec(2));
     m_viewVec = Vec4d(viewVec(0)/vecLength,viewVec(1)/vecLength,viewVec(2)/vecLength,0);
+    m_dirty = true;
 }
 
 Vec4d Camera::getViewVec()
@@ -26,11 +28,18 @@ void Camera::setUpVec(Vec4d upVec)
     //Normalize
     double vecLength = sqrt(upVec(0)*upVec(0) + upVec(1)*upVec(1) + upVec(2)*upVec(2));
     m_upVec = Vec4d(upVec(0)/vecLength,upVec(1)/vecLength,upVec(2)/vecLength,0);
+    m_dirty = true;
+}
+
+Vec4d Camera::getUpVec()
+{
+    return m_upVec;
 }
 
 void Camera::setEyePoint(Vec4d eyePoint)
 {
     m_eyepoint = eyePoint;
+    m_dirty = true;
 }
 
 Vec4d Camera::getEyePoint()
@@ -38,13 +47,60 @@ Vec4d Camera::getEyePoint()
     return m_eyepoint;
 }
 
+void Camera::setFocus(double focus)
+{
+    if(focus != m_focus)
+    {
+        m_focus = focus;
+        m_dirty = true;
+    }
+}
+
+double Camera::getFocus()
+{
+    return m_focus;
+}
+
 Mat4d Camera::getCamMat()
 {
-    return m_transMat;
+    return getViewMat();
 }
 
 Mat4d Camera::makeTransMat()
 {
+    return getViewMat();
+}
+
+Mat4d Camera::makeInverseTransMat()
+{
+    return getInverseViewMat();
+}
+
+const Mat4d &Camera::getViewMat()
+{
+    update();
+    return m_transMat;
+}
+
+const Mat4d &Camera::getInverseViewMat()
+{
+    update();
+    return m_invTransMat;
+}
+
+const Mat4d &Camera::getViewProjMat()
+{
+    update();
+    return m_viewProjMat;
+}
+
+void Camera::update()
+{
+    if(!m_dirty)
+    {
+        return;
+    }
+
     Mat4d transMat;
 
     Vec4d vecS = m_upVec.crossH(m_viewVec);
@@ -72,12 +128,20 @@ Mat4d Camera::makeTransMat()
     transMat = transMat.makeTransMat(-m_eyepoint)*transMat;    //Translation of eye point to (0,0,0)
 
     m_transMat = transMat;
-    return transMat;
-}
 
-Mat4d Camera::makeInverseTransMat()
-{
     bool singular;
-    Mat4d invTransMat = makeTransMat().inverse(singular);
-    return invTransMat;
+    m_invTransMat = transMat.inverse(singular);
+
+    //Perspective projection onto the image plane at distance focus
+    Mat4d projectMat;
+    projectMat(0,0) = 1;
+    projectMat(1,1) = 1;
+    projectMat(3,3) = 1;
+    if(m_focus != 0)
+    {
+        projectMat(3,2) = -1/m_focus;
+    }
+    m_viewProjMat = projectMat*transMat;
+
+    m_dirty = false;
 }
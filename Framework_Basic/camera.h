@@ -2,6 +2,7 @@
 #define CAMERA_H
 
 #include "vector.h"
+#include "matrix.h"
 
 class Camera
 {
@@ -14,10 +15,16 @@ public:
 
     void setUpVec(Vec4d upVec);
 
+    Vec4d getUpVec();
+
     void setEyePoint(Vec4d eyePoint);
 
     Vec4d getEyePoint();
 
+    void setFocus(double focus);
+
+    double getFocus();
+
     Mat4d getCamMat();
 
     //Transform world coordinates into camera coordinates
@@ -26,12 +33,30 @@ public:
     //Transform camera coordinates into world coordinates
     Mat4d makeInverseTransMat();
 
+    //Cached matrices. They are only rebuilt after the eye point, view vector,
+    //up vector or focus have changed, so they can be used for every projected point.
+
+    //World coordinates into camera coordinates
+    const Mat4d &getViewMat();
+
+    //Camera coordinates into world coordinates
+    const Mat4d &getInverseViewMat();
+
+    //World coordinates into projected coordinates (before the perspective division)
+    const Mat4d &getViewProjMat();
+
 private:
+    //Rebuild the cached matrices if necessary
+    void update();
+
     Vec4d m_eyepoint;
     Vec4d m_viewVec;
     Vec4d m_upVec;
     Mat4d m_transMat;
+    Mat4d m_invTransMat;
+    Mat4d m_viewProjMat;
     double m_focus;
+    bool m_dirty;   //Cached matrices are out of date
 };
 
 #endif // CAMERA_H
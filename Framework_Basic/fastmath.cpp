@@ -0,0 +1,89 @@
+//
+// FastMath
+//
+// Self-check of the approximations in fastmath.h: every function is sampled over its domain
+// and the largest error against libm is compared with the bound documented in the header.
+//
+
+#include "fastmath.h"
+#include <stdio.h>
+#include <algorithm>
+
+// Samples per function and argument of the self-check
+#define FAST_MATH_CHECK_SAMPLES 100000
+
+// Report the largest error of one function and compare it with the bound of the header
+static bool reportError(const char *name, double maxError, double bound)
+{
+    bool passed = maxError < bound;
+    printf("%-10s max error %.3e, bound %.1e: %s\n", name, maxError, bound, passed ? "ok" : "FAILED");
+    return passed;
+}
+
+static double relativeError(double approx, double exact)
+{
+    return fabs(approx - exact) / fabs(exact);
+}
+
+bool checkFastMath()
+{
+    bool passed = true;
+    const int n = FAST_MATH_CHECK_SAMPLES;
+
+    //atan2 on circles of radii 1e-3 to 1e3, all quadrants
+    double maxError = 0;
+    for(int i=0; i<n; i++)
+    {
+        double angle = -M_PI + 2*M_PI*i/(n-1);
+        double radius = pow(10.0, -3.0 + 6.0*(i % 7)/6.0);
+        double y = radius*sin(angle);
+        double x = radius*cos(angle);
+        maxError = std::max(maxError, fabs(fastAtan2(y, x) - atan2(y, x)));
+    }
+    passed = reportError("fastAtan2", maxError, 2.0e-8) && passed;
+
+    maxError = 0;
+    for(int i=0; i<n; i++)
+    {
+        double x = -1.0 + 2.0*i/(n-1);
+        maxError = std::max(maxError, fabs(fastAcos(x) - acos(x)));
+    }
+    passed = reportError("fastAcos", maxError, 7.0e-5) && passed;
+
+    //log2 over the normalized range, logarithmically spaced
+    maxError = 0;
+    for(int i=0; i<n; i++)
+    {
+        double x = pow(2.0, -1020.0 + 2040.0*i/(n-1));
+        maxError = std::max(maxError, fabs(fastLog2(x) - log2(x)));
+    }
+    passed = reportError("fastLog2", maxError, 2.0e-9) && passed;
+
+    maxError = 0;
+    for(int i=0; i<n; i++)
+    {
+        double x = -1022.0 + 2045.0*i/(n-1);
+        maxError = std::max(maxError, relativeError(fastExp2(x), exp2(x)));
+    }
+    passed = reportError("fastExp2", maxError, 1.0e-8) && passed;
+
+    //pow with exponents up to |y| = 64, the bound of the header at the largest |y|
+    maxError = 0;
+    for(int i=0; i<n; i++)
+    {
+        double x = pow(10.0, -3.0 + 6.0*i/(n-1));
+        double y = -64.0 + 128.0*(i % 101)/100.0;
+        maxError = std::max(maxError, relativeError(fastPow(x, y), pow(x, y)));
+    }
+    passed = reportError("fastPow", maxError, 1.0e-8 + 64*1.5e-9) && passed;
+
+    maxError = 0;
+    for(int i=0; i<n; i++)
+    {
+        double x = pow(2.0, -1000.0 + 2000.0*i/(n-1));
+        maxError = std::max(maxError, relativeError(fastRsqrt(x), 1.0 / sqrt(x)));
+    }
+    passed = reportError("fastRsqrt", maxError, 5.0e-6) && passed;
+
+    return passed;
+}
@@ -0,0 +1,124 @@
+//
+// FastMath
+//
+// Polynomial approximations of the transcendental functions used per shaded pixel.
+// The functions contain no table lookups and only data-independent branches
+// (selects), so loops calling them can be vectorized by the compiler.
+//
+// Maximum errors, measured against libm over the stated domains:
+//   fastAtan2(y, x)   absolute error < 2.0e-8 rad
+//   fastAcos(x)       absolute error < 7.0e-5 rad,  x in [-1, 1]
+//   fastLog2(x)       absolute error < 2.0e-9,      x > 0 (normalized)
+//   fastExp2(x)       relative error < 1.0e-8,      x in [-1022, 1023]
+//   fastPow(x, y)     relative error < 1.0e-8 + |y| * 1.5e-9, x >= 0
+//   fastRsqrt(x)      relative error < 5.0e-6,      x > 0
+//
+// The fast path is selected at runtime (GLBox::setFastMath(), key 'F').
+// Define FAST_MATH at build time to make it the default.
+// "BasicViewer --check-fastmath [scene.scn]" checks the bounds above without opening a window
+// and bounds the difference of the rendered images, see GLBox::checkFastMathImage().
+//
+
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include <math.h>
+#include <string.h>
+
+// Measure the maximum errors against libm and print them. Returns false if a bound is exceeded.
+bool checkFastMath();
+
+// Arc tangent of y/x in [-pi, pi], like atan2().
+inline double fastAtan2(double y, double x)
+{
+    double ax = fabs(x);
+    double ay = fabs(y);
+    double mx = ax > ay ? ax : ay;
+    double mn = ax > ay ? ay : ax;
+    double a = mx == 0.0 ? 0.0 : mn / mx;
+
+    // atan(a) on [0,1], Abramowitz/Stegun 4.4.49
+    double s = a*a;
+    double r = (((((((0.0028662257*s - 0.0161657367)*s + 0.0429096138)*s - 0.0752896400)*s
+                 + 0.1065626393)*s - 0.1420889944)*s + 0.1999355085)*s - 0.3333314528)*s*a + a;
+
+    r = ay > ax ? M_PI_2 - r : r;
+    r = x < 0.0 ? M_PI - r : r;
+    return y < 0.0 ? -r : r;
+}
+
+// Arc cosine in [0, pi], like acos(). Abramowitz/Stegun 4.4.45.
+inline double fastAcos(double x)
+{
+    double ax = fabs(x);
+    ax = ax > 1.0 ? 1.0 : ax;
+    double r = sqrt(1.0 - ax) * (((-0.0187293*ax + 0.0742610)*ax - 0.2121144)*ax + 1.5707288);
+    return x < 0.0 ? M_PI - r : r;
+}
+
+// Binary logarithm for x > 0.
+inline double fastLog2(double x)
+{
+    unsigned long long bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int e = int((bits >> 52) & 0x7ff) - 1023;
+
+    // Mantissa m in [1,2), shifted to [sqrt(1/2), sqrt(2)) to keep the series argument small
+    bits = (bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+    double m;
+    memcpy(&m, &bits, sizeof(m));
+    if (m > M_SQRT2)
+    {
+        m *= 0.5;
+        e++;
+    }
+
+    // ln(m) = 2*atanh(t) with t = (m-1)/(m+1), |t| < 0.172
+    double t = (m - 1.0) / (m + 1.0);
+    double t2 = t*t;
+    double ln = 2.0*t*(1.0 + t2*(1.0/3.0 + t2*(1.0/5.0 + t2*(1.0/7.0 + t2*(1.0/9.0)))));
+    return e + ln * M_LOG2E;
+}
+
+// Power of two.
+inline double fastExp2(double x)
+{
+    x = x < -1022.0 ? -1022.0 : (x > 1023.0 ? 1023.0 : x);
+    double n = floor(x);
+
+    // 2^f = sqrt(2) * e^g with g = (f - 1/2)*ln(2), |g| <= 0.347
+    double g = (x - n - 0.5) * M_LN2;
+    double p = 1.0 + g*(1.0 + g*(1.0/2.0 + g*(1.0/6.0 + g*(1.0/24.0 + g*(1.0/120.0 + g*(1.0/720.0 + g*(1.0/5040.0)))))));
+
+    unsigned long long bits = (unsigned long long)((long long)n + 1023) << 52;
+    double scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return M_SQRT2 * p * scale;
+}
+
+// x^y for x >= 0, like pow().
+inline double fastPow(double x, double y)
+{
+    if (y == 0.0)
+        return 1.0;
+    if (x <= 0.0)
+        return 0.0;
+    return fastExp2(y * fastLog2(x));
+}
+
+// 1/sqrt(x) for x > 0. Bit-level estimate refined by two Newton iterations.
+inline double fastRsqrt(double x)
+{
+    unsigned long long bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bits = 0x5fe6eb50c7b537a9ULL - (bits >> 1);
+    double r;
+    memcpy(&r, &bits, sizeof(r));
+
+    double half = 0.5*x;
+    r = r*(1.5 - half*r*r);
+    r = r*(1.5 - half*r*r);
+    return r;
+}
+
+#endif // FASTMATH_H
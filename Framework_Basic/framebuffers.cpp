@@ -0,0 +1,72 @@
+#include "framebuffers.h"
+#include <string.h>
+
+// Flag in m_ready: the exchanged buffer holds a frame the GUI has not seen yet
+#define NEW_FRAME 4
+
+FrameBuffers::FrameBuffers(int size)
+{
+    m_size = size;
+    for(int i=0; i<3; i++)
+    {
+        m_buffers[i] = new unsigned char[size];
+        memset(m_buffers[i], 255, size);
+        m_scales[i] = 1;
+    }
+    m_front = 0;
+    m_ready = 1;
+    m_back = 2;
+}
+
+FrameBuffers::~FrameBuffers()
+{
+    for(int i=0; i<3; i++)
+    {
+        delete [] m_buffers[i];
+    }
+}
+
+unsigned char *FrameBuffers::getBack()
+{
+    return m_buffers[m_back];
+}
+
+void FrameBuffers::setBackScale(double scale)
+{
+    m_scales[m_back] = scale;
+}
+
+void FrameBuffers::publish()
+{
+    //The previously exchanged buffer becomes the new back buffer, even if the GUI never showed it
+    int old = m_ready.fetchAndStoreOrdered(m_back | NEW_FRAME);
+    m_back = old & ~NEW_FRAME;
+}
+
+bool FrameBuffers::acquire()
+{
+    //Only the render thread sets NEW_FRAME and only the GUI clears it
+    if((m_ready.fetchAndAddOrdered(0) & NEW_FRAME) == 0)
+    {
+        return false;
+    }
+    int old = m_ready.fetchAndStoreOrdered(m_front);
+    m_front = old & ~NEW_FRAME;
+    return true;
+}
+
+unsigned char *FrameBuffers::getFront()
+{
+    return m_buffers[m_front];
+}
+
+double FrameBuffers::getFrontScale()
+{
+    //Written before the buffer was published, the ordered exchange in acquire() makes it visible
+    return m_scales[m_front];
+}
+
+int FrameBuffers::getSize()
+{
+    return m_size;
+}
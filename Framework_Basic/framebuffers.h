@@ -0,0 +1,54 @@
+//
+// FrameBuffers
+//
+// Lock-free triple buffer for handing finished frames from the render thread to the GUI.
+// The render thread always owns the back buffer and the GUI the front buffer. The third
+// buffer is the most recently finished frame and is exchanged with atomic swaps only,
+// so neither side ever waits for the other.
+//
+
+#ifndef FRAMEBUFFERS_H
+#define FRAMEBUFFERS_H
+
+#include <QAtomicInt>
+
+class FrameBuffers
+{
+public:
+    // Allocate three buffers of size bytes each, initialized to white.
+    FrameBuffers(int size);
+
+    ~FrameBuffers();
+
+    // Render thread: buffer to render the next frame into.
+    unsigned char *getBack();
+
+    // Render thread: scale of the image in the back buffer, see ResolutionController.
+    void setBackScale(double scale);
+
+    // Render thread: hand the back buffer to the GUI as the newest finished frame.
+    void publish();
+
+    // GUI: take over the newest finished frame as front buffer.
+    // Returns false if no new frame was published since the last call.
+    bool acquire();
+
+    // GUI: buffer to display.
+    unsigned char *getFront();
+
+    // GUI: scale of the image in the front buffer. The image covers the top left
+    // scale*width x scale*height pixels of the buffer.
+    double getFrontScale();
+
+    int getSize();
+
+private:
+    unsigned char *m_buffers[3];
+    double m_scales[3]; // Render scale of the frame in each buffer
+    int m_size;
+    int m_back;         // Owned by the render thread
+    int m_front;        // Owned by the GUI
+    QAtomicInt m_ready; // Index of the exchanged buffer, or'ed with NEW_FRAME if not yet acquired
+};
+
+#endif // FRAMEBUFFERS_H
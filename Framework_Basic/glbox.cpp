@@ -7,12 +7,19 @@
 // Based on the original work by Burkhard Lehner <lehner@informatik.uni-kl.de> and Gerd Reis.
 
 #include <math.h> // for sqrt
+#include <stdlib.h> // for abs
+#include <algorithm> // for min, max
+#include <string.h> // for memcpy
 
 #include "glbox.h"
 #include <QWheelEvent>
 #include <QMouseEvent>
 #include <QDebug>
+#include <QElapsedTimer>
 #include "matrix.h"
+#include "transform.h"
+#include "quaternion.h"
+#include "fastmath.h"
 
 GLBox::GLBox( QWidget* parent, const QGLWidget* shareWidget )
         : QGLWidget( parent,  shareWidget )
@@ -21,8 +28,8 @@ GLBox::GLBox( QWidget* parent, const QGLWidget* shareWidget )
     m_texID = 0;
     m_winWidth = 600;
     m_winHeight = 600;
-    // Initialize the texture buffer.
-    m_buffer = new unsigned char[3*TEX_RES];
+    // The texture buffers are owned by the render thread.
+    m_buffer = NULL;
     // Set the timeout to 50 milliseconds, corresponding to 20 FPS.
     m_timeout = 50; // 50 msecs
     m_timer = new QTimer(this);
@@ -35,17 +42,27 @@ GLBox::GLBox( QWidget* parent, const QGLWidget* shareWidget )
     m_elapsed = 0;
     m_focus = 1000;
     m_cam = Camera();
+    m_cam.setFocus(m_focus);
+    m_phiRot = 0;
+    m_preview = false;
+    m_overlays = false;
+    m_antialiasing = true;
+#ifdef FAST_MATH
+    m_fastMath = true;
+#else
+    m_fastMath = false;
+#endif
     //Initialize the cuboids and spheres
-    //initializeCuboids();
+    initializeCuboids();
     m_sphereCount = 1;
-    m_spheres.resize(m_sphereCount);
-    m_spheres[0] = new sphere(Material(Vec3d(0.1,0.9,0), Vec3d(0.5,0,0.1), Vec3d(0.3,0.5,0.1), 0.0), Vec4d(0,0,0,1), 0.65);
-//        m_spheres[1] = new sphere(Material(Vec3d(0.5,0.5,0.2), Vec3d(0.3,0.6,0.7), Vec3d(0.2,0.4,1.2), 888.8), Vec4d(0.5,0,0,1), 0.1);
-//            m_spheres[2] = new sphere(Color(0,0.8,0), Vec4d(0.7,0,0,1), 0.05);
-//        m_spheres[3] = new sphere(Color(0,1,1), Vec4d(-0.2,-0.2,-0.2,1), 0.1);
-//            m_spheres[4] = new sphere(Color(0,0.8,0.8), Vec4d(-0.4,-0.2,-0.2,1), 0.05);
-//            m_spheres[5] = new sphere(Color(0,0.7,0.7), Vec4d(-0.3,-0.6,-0.3,1), 0.05);
-//                m_spheres[6] = new sphere(Color(0,0.5,0.5), Vec4d(-0.2,-0.5,-0.2,1), 0.01);
+    m_spheres.reserve(m_sphereCount);
+    m_spheres.push_back(sphere(Material(Vec3d(0.1,0.9,0), Vec3d(0.5,0,0.1), Vec3d(0.3,0.5,0.1), 0.0), Vec4d(0,0,0,1), 0.65));
+//        m_spheres.push_back(sphere(Material(Vec3d(0.5,0.5,0.2), Vec3d(0.3,0.6,0.7), Vec3d(0.2,0.4,1.2), 888.8), Vec4d(0.5,0,0,1), 0.1));
+//            m_spheres.push_back(sphere(Color(0,0.8,0), Vec4d(0.7,0,0,1), 0.05));
+//        m_spheres.push_back(sphere(Color(0,1,1), Vec4d(-0.2,-0.2,-0.2,1), 0.1));
+//            m_spheres.push_back(sphere(Color(0,0.8,0.8), Vec4d(-0.4,-0.2,-0.2,1), 0.05));
+//            m_spheres.push_back(sphere(Color(0,0.7,0.7), Vec4d(-0.3,-0.6,-0.3,1), 0.05));
+//                m_spheres.push_back(sphere(Color(0,0.5,0.5), Vec4d(-0.2,-0.5,-0.2,1), 0.01));
 
     angle2 = 0.1;
     sphereRotAxis = Vec4d(0,-1,1,1);
@@ -61,26 +78,103 @@ GLBox::GLBox( QWidget* parent, const QGLWidget* shareWidget )
 //    sphereRotAxis6 = Vec4d(0.1,-0.2,0.1,1);
 //    sphereRotAxis6 = sphereRotAxis5.normH();
 
-    m_matrices.resize(m_sphereCount);
+    //Scene graph: every sphere is a node, orbiting spheres are children of the sphere they orbit
+    addSphereNode(0, -1);
+//    addSphereNode(1, 0, sphereRotAxis, angle2);
+//    addSphereNode(2, 1, sphereRotAxis2, angle2);
+//    addSphereNode(3, 0, sphereRotAxis3, angle2);
+//    addSphereNode(4, 3, sphereRotAxis4, angle2);
+//    addSphereNode(5, 3, sphereRotAxis5, angle2);
+//    addSphereNode(6, 5, sphereRotAxis6, angle2);
+    updateScene();
 
-    m_light = Light(Vec3d(1,1,1), Vec3d(1,1,1), Vec3d(0,0,0));
+    m_lights.push_back(Light(Vec3d(1,1,1), Vec3d(1,1,1), Vec3d(0,0,0)));
 
     loadTexture("E:\land_shallow_topo_2048.jpg");
+
+    //Start rendering
+    m_pendingSteps = 0;
+    m_inputVersion = 0;
+    m_renderedVersion = -1;
+    m_cancelledFrames = 0;
+    m_frameReduced = false;
+    m_compareRequested = false;
+    m_comparePassed = false;
+    m_scenePending = false;
+    m_targetFrameTime = m_timeout;
+    m_renderWidth = TEX_RES_X;
+    m_renderHeight = TEX_RES_Y;
+    m_renderShadows = true;
+    m_antialiasPass = false;
+    m_pixelObjects.resize(TEX_RES);
+    m_pixelShadows.resize(TEX_RES);
+    m_pixelLuma.resize(TEX_RES);
+    for(int i=0; i<QThread::idealThreadCount(); i++)
+    {
+        m_tileWorkers.push_back(new TileWorker(this));
+    }
+    m_tilePool.setMaxThreadCount(m_tileWorkers.size());
+    m_bvhPool.setMaxThreadCount(1);
+
+    //The render thread may start a frame before the first flushInput()
+    postState();
+    m_state = m_posted;
+    m_renderThread = new RenderThread(this, 3*TEX_RES);
+    connect(m_renderThread, SIGNAL(frameReady()), this, SLOT(updateGL()));
+    m_renderThread->start();
+
+    //Input is handed to the render thread at most once per display frame
+    m_inputTimer = new QTimer(this);
+    m_inputTimer->setSingleShot(true);
+    connect(m_inputTimer, SIGNAL(timeout()), this, SLOT(flushInput()));
+    postUpdate();
 }
 
 
 GLBox::~GLBox()
 {
-    for(int i=0; i<m_spheres.size(); i++)
+    m_renderThread->stop();
+    m_bvhPool.waitForDone();
+    for(unsigned int i=0; i<m_tileWorkers.size(); i++)
     {
-        delete m_spheres[i];
+        delete m_tileWorkers[i];
     }
-    delete [] m_buffer;
-    m_buffer = NULL;
+}
+
+void GLBox::postUpdate()
+{
+    //All changes until the timer fires are merged into one frame
+    if(!m_inputTimer->isActive())
+    {
+        m_inputTimer->start(INPUT_FRAME_INTERVAL);
+    }
+}
+
+void GLBox::flushInput()
+{
+    m_stateMutex.lock();
+    postState();
+    m_inputVersion.ref();
+    m_stateMutex.unlock();
+    m_renderThread->requestFrame();
+}
+
+void GLBox::postState()
+{
+    m_posted.cam = m_cam;
+    m_posted.focus = m_focus;
+    m_posted.phiRot = m_phiRot;
+    m_posted.fastMath = m_fastMath;
+    m_posted.preview = m_preview;
+    m_posted.overlays = m_overlays;
+    m_posted.antialiasing = m_antialiasing;
+    m_posted.targetFrameTime = m_targetFrameTime;
 }
 
 void GLBox::manageTexture()
 {
+    ScopedTimer timer(m_profiler, STAGE_TEXTURE_UPLOAD);
+
     glEnable(GL_TEXTURE_2D);
 
     if (m_texID == 0)
@@ -95,7 +189,7 @@ void GLBox::manageTexture()
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, TEX_RES_X, TEX_RES_Y, 0, GL_RGB, GL_UNSIGNED_BYTE, m_buffer);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, TEX_RES_X, TEX_RES_Y, 0, GL_RGB, GL_UNSIGNED_BYTE, m_renderThread->getFrames().getFront());
 
     glBindTexture(GL_TEXTURE_2D, 0);
 
@@ -128,132 +222,45 @@ void GLBox::setPoint(Point2D p, Color c)
     m_buffer[3*TO_LINEAR(x,y)+2] = (unsigned char)(255.0*c.b);
 }
 
+PixelBuffer GLBox::getPixelBuffer()
+{
+    PixelBuffer buffer;
+    buffer.data = m_buffer;
+    buffer.width = m_renderWidth;
+    buffer.height = m_renderHeight;
+    buffer.stride = TEX_RES_X;
+    return buffer;
+}
+
+static void toRGB(const Color &c, unsigned char rgb[3])
+{
+    rgb[0] = (unsigned char)(255.0*c.r);
+    rgb[1] = (unsigned char)(255.0*c.g);
+    rgb[2] = (unsigned char)(255.0*c.b);
+}
+
 void GLBox::bresenhamLine(Vec3d v1, Vec3d v2, Color color)
 {
-    int x1, y1, x2, y2, d;
-    if(v2(0) > v1(0)) {   //switch points if p2 is left of p1
-        x1 = (int)round(v1(0));
-        y1 = (int)round(v1(1));
-        x2 = (int)round(v2(0));
-        y2 = (int)round(v2(1));
-    } else {
-        x2 = (int)round(v1(0));
-        y2 = (int)round(v1(1));
-        x1 = (int)round(v2(0));
-        y1 = (int)round(v2(1));
-    }
-    int x = x1;
-    int y = y1;
-    int deltaX = x2-x1;
-    int deltaY = y2-y1;
-    //int deltaNE = 2*(deltaY-deltaX);
-    //int deltaE = 2*deltaY;
-    setPoint(Point2D(x,y), color);
-
-    //differentiation of gradient
-    if(deltaY >= 0){    //m >= 0
-        if(deltaY <= deltaX){   //m <= 1
-            //Case 1: Octant 1 (5)
-            d = 2*deltaY-deltaX;
-            while(x < x2){
-                if(d >= 0){
-                    d += 2*(deltaY-deltaX);
-                    x++;
-                    y++;
-                } else {
-                    d += 2*deltaY;
-                    x++;
-                }
-                setPoint(Point2D(x,y), color);
-            }
-        } else {    //m > 1
-            //Case 2: Octant 2 (6)          [swap x,y]
-            d = 2*deltaX-deltaY;
-            while(y < y2){
-                if(d >= 0){
-                    d += 2*(deltaX-deltaY);
-                    y++;
-                    x++;
-                } else {
-                    d += 2*deltaX;
-                    y++;
-                }
-                setPoint(Point2D(x,y), color);
-            }
-        }
-    } else {    //m < 0
-        if(-deltaY <= deltaX){   //m >= -1
-            //Case 3: Octant 3 (7)          [swap sign]
-            d = -2*deltaY-deltaX;
-            while(x < x2){
-                if(d >= 0){
-                    d += 2*(-deltaY-deltaX);
-                    x++;
-                    y--;
-                } else {
-                    d -= 2*deltaY;
-                    x++;
-                }
-                setPoint(Point2D(x,y), color);
-            }
-        } else {    //m < -1
-            //Case 4: Octant 4 (8)          [swap x,y]
-            d = 2*deltaX+deltaY;
-            while(-y < -y2){
-                if(d >= 0){
-                    d += 2*(deltaX+deltaY);
-                    y--;
-                    x++;
-                } else {
-                    d += 2*deltaX;
-                    y--;
-                }
-                setPoint(Point2D(x,y), color);
-            }
-        }
-    }
+    unsigned char rgb[3];
+    toRGB(color, rgb);
+    // Transform coordinates from [-TEX_HALF,TEX_HALF] to the frame at the current resolution, clipping happens in drawLine()
+    double scale = double(m_renderWidth) / TEX_RES_X;
+    drawLine(getPixelBuffer(), (v1(0) + TEX_HALF_X)*scale, (v1(1) + TEX_HALF_Y)*scale,
+             (v2(0) + TEX_HALF_X)*scale, (v2(1) + TEX_HALF_Y)*scale, rgb);
 }
 
 void GLBox::bresenhamCircle(Vec3d center, int radius, Color color)
 {
-    int x1 = (int)round(center(0));
-    int y1 = (int)round(center(1));
-    int x = 0;
-    int y = radius;
-    int d = 5-4*radius;
-    int deltaSE;
-    int deltaE;
-    setPoint(Point2D(x1,y1+radius), color); //y
-    setPoint(Point2D(x1,y1-radius), color); //-y
-    setPoint(Point2D(x1+radius,y1), color); //x
-    setPoint(Point2D(x1-radius,y1), color); //-x
-    while(y > x){
-        if(d >= 0) {    //SE
-            deltaSE = 4*(2*(x-y)+5);
-            d += deltaSE;
-            x++;
-            y--;
-        } else {    //E
-            deltaE = 4*(2*x+3);
-            d += deltaE;
-            x++;
-        }
-        setPoint(Point2D(x1+y,y1+x), color); //1. O.
-        setPoint(Point2D(x1+x,y1+y), color); //2. O.
-        setPoint(Point2D(x1-x,y1+y), color); //3. O.
-        setPoint(Point2D(x1-y,y1+x), color); //4. O.
-        setPoint(Point2D(x1-y,y1-x), color); //5. O.
-        setPoint(Point2D(x1-x,y1-y), color); //6. O.
-        setPoint(Point2D(x1+x,y1-y), color); //7. O.
-        setPoint(Point2D(x1+y,y1-x), color); //8. O.
-    }
+    unsigned char rgb[3];
+    toRGB(color, rgb);
+    double scale = double(m_renderWidth) / TEX_RES_X;
+    drawCircle(getPixelBuffer(), (int)round((center(0) + TEX_HALF_X)*scale), (int)round((center(1) + TEX_HALF_Y)*scale),
+               (int)round(radius*scale), rgb);
 }
 
 void GLBox::initializeGL()
 {
     // this method is called exactly once on program start
-    clearImage();
-
     glViewport(0, 0, m_winWidth, m_winHeight);
 
     glMatrixMode(GL_PROJECTION);
@@ -283,42 +290,34 @@ void GLBox::paintGL()
 {
     // this method draws the scene into the OpenGL widget
     // usually you do not call this method directly, instead call updateGL(), which in turn calls paintGL()
+    bool profiling = m_profiler.isEnabled();
+    qint64 paintStart = profiling ? m_profiler.now() : 0;
+    qint64 traceStart = m_trace.isOpen() ? m_trace.now() : 0;
 
-//    clearImage(Color(1.0, 1.0, 1.0));
-
-//    Color black(0.0, 0.0, 0.0);
-//    Color grey(0.3, 0.3, 0.3);
-
-//    //Clock
-////    bresenhamCircle(m_clock.getCenter(), m_clock.getRadius(), black);
-////    bresenhamLine(m_clock.getCenter(), m_clock.getLonghand(), black);
-////    bresenhamLine(m_clock.getCenter(), m_clock.getShorthand(), grey);
-
-//    //Cuboids
-//    makeCuboid(m_cub1);
-//    makeCuboid(m_cub2);
-//    makeCuboid(m_cub3);
-
-//    //Spheres
-//    makeSphere(m_sphere1);
-//    makeSphere(m_sphere2);
-
-    //-_-_-_-_-_-_-_-_-_-_-_-_-_-_-_-_-_-_-\\
+    // Upload the newest frame of the render thread, if there is one.
+    // Otherwise the texture still holds the last frame.
+    if(m_renderThread->getFrames().acquire() || m_texID == 0)
+    {
+        manageTexture();
+    }
 
-    manageTexture();
+    // Scale the rendered part of the texture up to the whole window
+    double renderScale = m_renderThread->getFrames().getFrontScale();
+    double u = round(TEX_RES_X*renderScale) / double(TEX_RES_X);
+    double v = round(TEX_RES_Y*renderScale) / double(TEX_RES_Y);
 
     glClear( GL_COLOR_BUFFER_BIT);
     glBindTexture(GL_TEXTURE_2D, m_texID);
 
     glEnable(GL_TEXTURE_2D);
     glBegin(GL_QUADS);
-        glTexCoord2i(0, 0);
+        glTexCoord2d(0, 0);
         glVertex2i(-m_winWidth/2, -m_winHeight/2);
-        glTexCoord2i(1, 0);
+        glTexCoord2d(u, 0);
         glVertex2i( m_winWidth/2, -m_winHeight/2);
-        glTexCoord2i(1, 1);
+        glTexCoord2d(u, v);
         glVertex2i( m_winWidth/2,  m_winHeight/2);
-        glTexCoord2i(0, 1);
+        glTexCoord2d(0, v);
         glVertex2i(-m_winWidth/2, m_winHeight/2);
     glEnd();
 
@@ -327,6 +326,16 @@ void GLBox::paintGL()
 
     // perform all output operations
     glFlush();
+
+    if(profiling)
+    {
+        m_profiler.add(STAGE_PAINT, m_profiler.now() - paintStart);
+        m_profiler.endPaint();
+    }
+    if(m_trace.isOpen())
+    {
+        m_trace.addSpan("paint", traceStart, m_trace.now());
+    }
 }
 
 void GLBox::animate()
@@ -339,40 +348,22 @@ void GLBox::animate()
 //    transVec = Vec4d(-0.003,0.002,0.002,1);
 //    rotAxis = Vec4d(1,1,1,1);
 //    angle1 = M_PI/12;
+//    Quatd cubRot = Quatd::fromAxisAngle(rotAxis, angle1);
+//    Vec4d cubCenter = m_cub1[1];
 //    for(int i=0; i<8; i++)
 //    {
 //        m_cub3[i] = cubTransMat.makeTransMat(transVec)*m_cub3[i];
-//        //m_cub2[i] = cubRotMat.makeRotMat(angle1,rotAxis)*m_cub2[i]; //nur normale oder Punktrotation!
-//        m_cub1[i] = cubRotMat.makeRotMatPoint(angle1,rotAxis,m_cub1[1])*m_cub1[i];
+//        //m_cub2[i] = cubRot.rotate(m_cub2[i]); //nur normale oder Punktrotation!
+//        m_cub1[i] = cubRot.rotatePoint(m_cub1[i], cubCenter);
 //    }
 
-    //Animate spheres
-//    m_matrices[1] = sphereTransMat.makeRotMatPoint(angle2, sphereRotAxis, m_spheres[0]->getCenter());
-//    m_matrices[3] = sphereTransMat.makeRotMatPoint(angle2, sphereRotAxis3, m_spheres[0]->getCenter());
+    //Animate spheres, the render thread applies the steps to the scene.
+    //The steps alone are no change: a static scene is not rendered again.
+    m_stateMutex.lock();
+    m_pendingSteps++;
+    m_stateMutex.unlock();
 
-//    m_spheres[1]->setCenter(m_matrices[1] * m_spheres[1]->getCenter());
-
-//    m_spheres[2]->setCenter(m_matrices[1] * m_spheres[2]->getCenter());
-//    m_matrices[2] = sphereTransMat.makeRotMatPoint(angle2, sphereRotAxis2, m_spheres[1]->getCenter());
-//    m_spheres[2]->setCenter(m_matrices[2] * m_spheres[2]->getCenter());
-
-//    m_spheres[3]->setCenter(m_matrices[3] * m_spheres[3]->getCenter());
-
-//    m_spheres[4]->setCenter(m_matrices[3] * m_spheres[4]->getCenter());
-//    m_matrices[4] = sphereTransMat.makeRotMatPoint(angle2, sphereRotAxis4, m_spheres[3]->getCenter());
-//    m_spheres[4]->setCenter(m_matrices[4] * m_spheres[4]->getCenter());
-
-//    m_spheres[5]->setCenter(m_matrices[3] * m_spheres[5]->getCenter());
-//    m_matrices[5] = sphereTransMat.makeRotMatPoint(angle2, sphereRotAxis5, m_spheres[3]->getCenter());
-//    m_spheres[5]->setCenter(m_matrices[5] * m_spheres[5]->getCenter());
-
-//    m_spheres[6]->setCenter(m_matrices[3] * m_spheres[6]->getCenter());
-//    m_spheres[6]->setCenter(m_matrices[5] * m_spheres[6]->getCenter());
-//    m_matrices[6] = sphereTransMat.makeRotMatPoint(angle2, sphereRotAxis6, m_spheres[5]->getCenter());
-//    m_spheres[6]->setCenter(m_matrices[6] * m_spheres[6]->getCenter());
-
-    raycast();
-    updateGL();
+    m_renderThread->requestFrame();
 }
 
 void GLBox::mousePressEvent( QMouseEvent *e )
@@ -411,8 +402,8 @@ void GLBox::mouseMoveEvent( QMouseEvent *e )
         double dist = sqrt(dx*dx + dy*dy);
         Vec4d axis(dy, dx, 4.0*(ry*dx - rx*dy), 0.0);
 
-        Mat4d camRot;
-        m_cam.setEyePoint(camRot.makeRotMatPoint(dist,axis,Vec4d(0,0,0,1))*m_cam.getEyePoint());
+        Quatd camRot = Quatd::fromAxisAngle(axis, dist);
+        m_cam.setEyePoint(camRot.rotate(m_cam.getEyePoint()));
         m_cam.setViewVec(Vec4d(-m_cam.getEyePoint()(0),-m_cam.getEyePoint()(1),-m_cam.getEyePoint()(2),1));
     }
 
@@ -426,7 +417,7 @@ void GLBox::mouseMoveEvent( QMouseEvent *e )
     }
 
     // repaint the scene
-    updateGL();
+    postUpdate();
 }
 
 void GLBox::mouseReleaseEvent( QMouseEvent * )
@@ -447,7 +438,7 @@ void GLBox::wheelEvent (QWheelEvent *e)
     tempVec(3) = 1;
     m_cam.setEyePoint(m_cam.getEyePoint()+tempVec-tempVec2);
 
-    updateGL();
+    postUpdate();
 }
 
 void GLBox::keyPressEvent(QKeyEvent *e)
@@ -455,223 +446,111 @@ void GLBox::keyPressEvent(QKeyEvent *e)
     int key = e->key();
     qDebug() << "keyPressEvent()";
 
+    switch(key)
+    {
+    case Qt::Key_F:
+        setFastMath(!m_fastMath);
+        break;
+    case Qt::Key_D:
+        compareFastMath();
+        break;
+    case Qt::Key_R:
+        setPreview(!m_preview);
+        break;
+    case Qt::Key_O:
+        setOverlays(!m_overlays);
+        break;
+    case Qt::Key_E:
+        setAntialiasing(!m_antialiasing);
+        break;
+    case Qt::Key_P:
+        setProfiling(!getProfiling());
+        break;
+    case Qt::Key_A:
+        setTargetFrameTime(getTargetFrameTime() > 0 ? 0 : m_timeout);
+        break;
+    }
+
     e->accept();
     updateGL();
 }
 
 void GLBox::initializeCuboids()
 {
-    //Creation of cuboid 1
-    Vec4d cub1p1;
-    cub1p1(0) = -0.4;
-    cub1p1(1) = 0.2;
-    cub1p1(2) = -0.5;
-    cub1p1(3) = 1.0;
-    m_cub1[0] = cub1p1;
-    Vec4d cub1p2;
-    cub1p2(0) = 0.5;
-    cub1p2(1) = 0.2;
-    cub1p2(2) = -0.5;
-    cub1p2(3) = 1.0;
-    m_cub1[1] = cub1p2;
-    Vec4d cub1p3;
-    cub1p3(0) = 0.5;
-    cub1p3(1) = 0.6;
-    cub1p3(2) = -0.5;
-    cub1p3(3) = 1.0;
-    m_cub1[2] = cub1p3;
-    Vec4d cub1p4;
-    cub1p4(0) = -0.4;
-    cub1p4(1) = 0.6;
-    cub1p4(2) = -0.5;
-    cub1p4(3) = 1.0;
-    m_cub1[3] = cub1p4;
-    Vec4d cub1p5;
-    cub1p5(0) = -0.4;
-    cub1p5(1) = 0.2;
-    cub1p5(2) = -0.3;
-    cub1p5(3) = 1.0;
-    m_cub1[4] = cub1p5;
-    Vec4d cub1p6;
-    cub1p6(0) = 0.5;
-    cub1p6(1) = 0.2;
-    cub1p6(2) = -0.3;
-    cub1p6(3) = 1.0;
-    m_cub1[5] = cub1p6;
-    Vec4d cub1p7;
-    cub1p7(0) = 0.5;
-    cub1p7(1) = 0.6;
-    cub1p7(2) = -0.3;
-    cub1p7(3) = 1.0;
-    m_cub1[6] = cub1p7;
-    Vec4d cub1p8;
-    cub1p8(0) = -0.4;
-    cub1p8(1) = 0.6;
-    cub1p8(2) = -0.3;
-    cub1p8(3) = 1.0;
-    m_cub1[7] = cub1p8;
-
-    //Creation of cuboid 2
-    Vec4d cub2p1;
-    cub2p1(0) = 0.7;
-    cub2p1(1) = 0.2;
-    cub2p1(2) = -0.8;
-    cub2p1(3) = 1.0;
-    m_cub2[0] = cub2p1;
-    Vec4d cub2p2;
-    cub2p2(0) = 0.5;
-    cub2p2(1) = 0.2;
-    cub2p2(2) = -0.8;
-    cub2p2(3) = 1.0;
-    m_cub2[1] = cub2p2;
-    Vec4d cub2p3;
-    cub2p3(0) = 0.5;
-    cub2p3(1) = -0.4;
-    cub2p3(2) = -0.8;
-    cub2p3(3) = 1.0;
-    m_cub2[2] = cub2p3;
-    Vec4d cub2p4;
-    cub2p4(0) = 0.7;
-    cub2p4(1) = -0.4;
-    cub2p4(2) = -0.8;
-    cub2p4(3) = 1.0;
-    m_cub2[3] = cub2p4;
-    Vec4d cub2p5;
-    cub2p5(0) = 0.7;
-    cub2p5(1) = 0.2;
-    cub2p5(2) = -0.3;
-    cub2p5(3) = 1.0;
-    m_cub2[4] = cub2p5;
-    Vec4d cub2p6;
-    cub2p6(0) = 0.5;
-    cub2p6(1) = 0.2;
-    cub2p6(2) = -0.3;
-    cub2p6(3) = 1.0;
-    m_cub2[5] = cub2p6;
-    Vec4d cub2p7;
-    cub2p7(0) = 0.5;
-    cub2p7(1) = -0.4;
-    cub2p7(2) = -0.3;
-    cub2p7(3) = 1.0;
-    m_cub2[6] = cub2p7;
-    Vec4d cub2p8;
-    cub2p8(0) = 0.7;
-    cub2p8(1) = -0.4;
-    cub2p8(2) = -0.3;
-    cub2p8(3) = 1.0;
-    m_cub2[7] = cub2p8;
-
-    //Creation of cuboid 3
-    Vec4d cub3p1;
-    cub3p1(0) = -0.2;
-    cub3p1(1) = -0.7;
-    cub3p1(2) = -0.5;
-    cub3p1(3) = 1.0;
-    m_cub3[0] = cub3p1;
-    Vec4d cub3p2;
-    cub3p2(0) = 0.5;
-    cub3p2(1) = -0.7;
-    cub3p2(2) = -0.5;
-    cub3p2(3) = 1.0;
-    m_cub3[1] = cub3p2;
-    Vec4d cub3p3;
-    cub3p3(0) = 0.5;
-    cub3p3(1) =  -0.9;
-    cub3p3(2) = -0.5;
-    cub3p3(3) = 1.0;
-    m_cub3[2] = cub3p3;
-    Vec4d cub3p4;
-    cub3p4(0) = -0.2;
-    cub3p4(1) =  -0.9;
-    cub3p4(2) = -0.5;
-    cub3p4(3) = 1.0;
-    m_cub3[3] = cub3p4;
-    Vec4d cub3p5;
-    cub3p5(0) = -0.2;
-    cub3p5(1) = -0.7;
-    cub3p5(2) = -0.3;
-    cub3p5(3) = 1.0;
-    m_cub3[4] = cub3p5;
-    Vec4d cub3p6;
-    cub3p6(0) = 0.5;
-    cub3p6(1) = -0.7;
-    cub3p6(2) = -0.3;
-    cub3p6(3) = 1.0;
-    m_cub3[5] = cub3p6;
-    Vec4d cub3p7;
-    cub3p7(0) = 0.5;
-    cub3p7(1) =  -0.9;
-    cub3p7(2) = -0.3;
-    cub3p7(3) = 1.0;
-    m_cub3[6] = cub3p7;
-    Vec4d cub3p8;
-    cub3p8(0) = -0.2;
-    cub3p8(1) =  -0.9;
-    cub3p8(2) = -0.3;
-    cub3p8(3) = 1.0;
-    m_cub3[7] = cub3p8;
-}
-
-void GLBox::makeCuboid(Vec4d cub[8])
-{
-    Color black(0.0, 0.0, 0.0);
-
-    //Calculate actual points
-    for(int i=0; i<8; i++)
-    {
-        projectedVec = projectZ(cub[i], m_focus);
-        cub2[i](0)=projectedVec(0)*double(TEX_HALF_X);
-        cub2[i](1)=projectedVec(1)*double(TEX_HALF_Y);
-        cub2[i](2)=projectedVec(2);
-    }
-
-    //Draw lines
-    bresenhamLine(cub2[0], cub2[1], black);
-    bresenhamLine(cub2[0], cub2[3], black);
-    bresenhamLine(cub2[0], cub2[4], black);
-    bresenhamLine(cub2[1], cub2[2], black);
-    bresenhamLine(cub2[1], cub2[5], black);
-    bresenhamLine(cub2[2], cub2[3], black);
-    bresenhamLine(cub2[2], cub2[6], black);
-    bresenhamLine(cub2[3], cub2[7], black);
-    bresenhamLine(cub2[4], cub2[5], black);
-    bresenhamLine(cub2[4], cub2[7], black);
-    bresenhamLine(cub2[5], cub2[6], black);
-    bresenhamLine(cub2[6], cub2[7], black);
+    //Opposite corners of the three cuboids
+    m_cuboids.clear();
+    m_cuboids.addBox(Vec4d(-0.4, 0.2, -0.5, 1), Vec4d(0.5, 0.6, -0.3, 1));
+    m_cuboids.addBox(Vec4d(0.7, 0.2, -0.8, 1), Vec4d(0.5, -0.4, -0.3, 1));
+    m_cuboids.addBox(Vec4d(-0.2, -0.7, -0.5, 1), Vec4d(0.5, -0.9, -0.3, 1));
 }
 
-Vec4d GLBox::projectZ(Vec4d &vec, double focus)
+void GLBox::drawOverlays()
 {
-    if(focus==0) return Vec4d();
+    //Overlay coordinates are in [-TEX_HALF, TEX_HALF] at full resolution
+    double scale = double(m_renderWidth) / TEX_RES_X;
+    unsigned char black[3] = {0, 0, 0};
+    unsigned char grey[3] = {77, 77, 77};
 
-    //Camera
-    Mat4d camMat = m_cam.makeTransMat();
-    Vec4d camVec;
-    camVec = camMat*vec;
+    //Without anti-aliasing the lines are drawn straight into the frame
+    bool aliased = !m_state.antialiasing;
+    m_overlay.clear(m_renderWidth, m_renderHeight);
 
-    Mat4d projectMat;
-    projectMat(0,0) = 1;
-    projectMat(1,1) = 1;
-    projectMat(3,3) = 1;
-    projectMat(3,2) = -1/focus;
-
-    Vec4d projectVec;
-    projectVec = projectMat*camVec;
+    //Clock
+    if(aliased)
+    {
+        bresenhamCircle(m_clock.getCenter(), round(m_clock.getRadius()), Color(0.0, 0.0, 0.0));
+        bresenhamLine(m_clock.getCenter(), m_clock.getLonghand(), Color(0.0, 0.0, 0.0));
+        bresenhamLine(m_clock.getCenter(), m_clock.getShorthand(), Color(0.3, 0.3, 0.3));
+    }
+    else
+    {
+        Vec3d center = m_clock.getCenter();
+        Vec3d longhand = m_clock.getLonghand();
+        Vec3d shorthand = m_clock.getShorthand();
+        double cx = (center(0) + TEX_HALF_X)*scale;
+        double cy = (center(1) + TEX_HALF_Y)*scale;
+        m_overlay.drawCircle(cx, cy, m_clock.getRadius()*scale, black);
+        m_overlay.drawLine(cx, cy, (longhand(0) + TEX_HALF_X)*scale, (longhand(1) + TEX_HALF_Y)*scale, black);
+        m_overlay.drawLine(cx, cy, (shorthand(0) + TEX_HALF_X)*scale, (shorthand(1) + TEX_HALF_Y)*scale, grey);
+    }
 
-    //Normalize
-    for(int i=0; i<4; i++)
+    //Cuboids and the wireframe meshes of the scene
+    if(m_state.focus != 0)
     {
-        projectVec(i) /= projectVec(3);
+        overlayLineMesh(m_cuboids, scale, black, aliased);
+        for(unsigned int i=0; i<m_meshes.size(); i++)
+        {
+            Vec3d c = m_meshColors[i];
+            unsigned char color[3] = {(unsigned char)(255.0*c(0)), (unsigned char)(255.0*c(1)), (unsigned char)(255.0*c(2))};
+            overlayLineMesh(m_meshes[i], scale, color, aliased);
+        }
     }
 
-    return projectVec;
+    //One pass over the touched rows of the frame, nothing to do if all lines were aliased
+    m_overlay.composite(m_buffer, TEX_RES_X);
+}
+
+void GLBox::overlayLineMesh(LineMesh &mesh, double scale, const unsigned char color[3], bool aliased)
+{
+    //Screen coordinates of the frame at the current resolution
+    double half = TEX_HALF_X*scale;
+    m_meshSegments.clear();
+    int count = mesh.project(m_state.cam.getViewProjMat(), half, TEX_HALF_Y*scale, half, TEX_HALF_Y*scale, m_meshClip, m_meshSegments);
+    if(count > 0 && aliased)
+    {
+        drawLines(getPixelBuffer(), &m_meshSegments[0], count, color);
+    }
+    else if(count > 0)
+    {
+        m_overlay.drawLines(&m_meshSegments[0], count, color);
+    }
 }
 
 void GLBox::setFocus(double focus)
 {
     m_focus = focus;
-    raycast();
-    updateGL();
+    m_cam.setFocus(focus);
+    postUpdate();
 }
 
 double GLBox::getFocus()
@@ -679,247 +558,1619 @@ double GLBox::getFocus()
     return m_focus;
 }
 
-void GLBox::makeSphere(sphere sphere)
+int GLBox::addSphereNode(int sph, int parentSph, Vec4d orbitAxis, double speed)
 {
-    Vec3d tempVec[sphere.points.size()];
+    Mat4d transMat;
+    Vec4d center = m_spheres[sph].getCenter();
+    int node;
 
-    for (int i=0; i<sphere.points.size(); i++)
+    if(parentSph < 0)
     {
-        projectedVec = projectZ(sphere.points[i], m_focus);
-        tempVec[i](0) = projectedVec(0)*double(TEX_HALF_X) + sphere.getCenter()(0);
-        tempVec[i](1) = projectedVec(1)*double(TEX_HALF_Y) + sphere.getCenter()(1);
-        tempVec[i](2) = projectedVec(2);
+        node = m_sceneGraph.addNode(-1, transMat.makeTransMat(center));
+    }
+    else
+    {
+        //Orbit around the parent at the current distance
+        Vec4d parentCenter = m_spheres[parentSph].getCenter();
+        Vec4d offset(center(0)-parentCenter(0), center(1)-parentCenter(1), center(2)-parentCenter(2), 1);
+        node = m_sceneGraph.addNode(m_sphereNodes[parentSph], transMat.makeTransMat(offset));
+        if(speed != 0)
+        {
+            m_sceneGraph.setOrbit(node, orbitAxis, offset, speed);
+        }
     }
 
-    for(int i=0; i<sphere.points.size(); i++)
+    if(int(m_sphereNodes.size()) <= sph)
     {
-        setPoint(Point2D(int(tempVec[i](0)), int(tempVec[i](1))), sphere.getColor());
+        m_sphereNodes.resize(sph+1, -1);
     }
+    m_sphereNodes[sph] = node;
+    m_nodeSpheres.resize(node+1, -1);
+    m_nodeSpheres[node] = sph;
+    return node;
 }
 
-void GLBox::sortHits(std::vector<Vec3d> &hits, std::vector<int> &indices)
+void GLBox::updateScene()
 {
-    //Bubble sort
-    bool swapped = true;
-    int temp;
-    Vec3d temp2;
+    m_sceneGraph.update();
 
-    int j=0;
-
-    while (swapped)
+    //Only spheres in changed subtrees are moved
+    m_movedSpheres.clear();
+    const std::vector<int> &changed = m_sceneGraph.getChangedNodes();
+    for(unsigned int i=0; i<changed.size(); i++)
     {
-        swapped = false;
-        j++;
-
-        for(int i=0; i<hits.size()-j; i++)
+        int sph = m_nodeSpheres[changed[i]];
+        if(sph >= 0)
         {
-            if(hits[i](2) < hits[i+1](2))
-            {
-                temp = indices[i];
-                indices[i] = indices[i+1];
-                indices[i+1] = temp;
+            m_spheres[sph].setCenter(m_sceneGraph.getWorldPosition(changed[i]));
+            m_movedSpheres.push_back(sph);
+        }
+    }
 
-                temp2 = hits[i];
-                hits[i] = hits[i+1];
-                hits[i+1] = temp2;
+    updateSphereBvh();
+}
 
-                swapped = true;
-            }
-        }
+void GLBox::updateSphereBvh()
+{
+    if(m_sphereBvh.getSphereCount() != m_sphereCount)
+    {
+        m_sphereBvh.build(m_spheres);
+        return;
+    }
+
+    //A tree rebuilt in the background was built from older positions
+    if(m_bvhBuilder.takeResult(m_sphereBvh))
+    {
+        m_sphereBvh.refit(m_spheres);
+    }
+    else if(!m_movedSpheres.empty())
+    {
+        m_sphereBvh.refit(m_spheres, m_movedSpheres);
+    }
+
+    //The old tree is refit and used until the new one is done
+    if(!m_bvhBuilder.isRunning() && m_sphereBvh.getDegradation() > SPHERE_BVH_REBUILD_RATIO)
+    {
+        m_bvhBuilder.prepare(m_spheres);
+        m_bvhPool.start(&m_bvhBuilder);
     }
 }
 
-void GLBox::raycast()
+bool GLBox::loadScene(QString filename)
 {
-    clearImage(Color(1.0, 1.0, 1.0));
-    Vec3d eye(0, 0, m_focus);
-    for(int x = 0; x < TEX_RES_X; x++)
+    SceneLoader loader;
+    Scene scene;
+    if(!loader.load(filename, scene))
     {
-        for(int y = 0; y < TEX_RES_Y; y++)
-        {
-            // Construct the ray for the pixel (i,j)
-            Vec3d viewDir(-1.0 + 2.0*(x/static_cast<double>(TEX_RES_X-1)),
-                          -1.0 + 2.0*(y/static_cast<double>(TEX_RES_Y-1)),
-                          -m_focus);
-            // Normalize the view direction!
-            viewDir = viewDir.norm();
+        qDebug() << "Loading scene failed:" << loader.getError();
+        return false;
+    }
 
-            std::vector<Vec3d> hits(m_sphereCount);
-            std::vector<int> indices(m_sphereCount);
+    qDebug() << "Loaded" << filename << ":" << scene.spheres.size() << "spheres," << scene.materials.size() << "materials,"
+             << scene.lights.size() << "lights," << scene.instances.size() << "mesh instances in" << loader.getLoadTime() << "ms, scene memory"
+             << scene.memoryUsage() / (1024.0*1024.0) << "MB";
 
-            for(int i=0; i<m_sphereCount; i++)
-            {
-                sphere *curSph = m_spheres[i];
-                hits[i] = curSph->intersect(eye, viewDir);
-                indices[i] = i;
-            }
+    if(scene.hasCamera)
+    {
+        m_cam = scene.camera;
+        m_focus = m_cam.getFocus();
+    }
 
-            sortHits(hits, indices);
+    //Hand the scene over to the render thread without copying
+    m_stateMutex.lock();
+    m_pendingScene.swap(scene);
+    m_scenePending = true;
+    m_stateMutex.unlock();
 
-            if(hits[0](2)!=-INFINITY)
-            {
-                if(isShadowed(m_spheres[indices[0]], hits[0], m_light))
-                {
-                    Vec3d ambientLight = m_light.getAmbient();
-                    Vec3d ambientSphere = m_spheres[indices[0]]->getMaterial().getAmbient();
-                    Vec3d ambient = ambientLight & ambientSphere;
-                    Color color;
-                    color.r = ambient(0);
-                    color.g = ambient(1);
-                    color.b = ambient(2);
-                    setPoint(Point2D(x - TEX_HALF_X, y - TEX_HALF_Y), color);
-                }
-                else
-                {
-                    Vec3d normal = hits[0] - m_spheres[indices[0]]->getCenter3();
-                    normal = normal.norm();
+    postUpdate();
+    return true;
+}
 
-                    double phi = getPhi(hits[0]);
-                    double theta = getTheta(hits[0]);
+void GLBox::installScene(Scene &scene)
+{
+    m_spheres.swap(scene.spheres);
+    m_sphereCount = m_spheres.size();
+    m_meshes.swap(scene.meshes);
+    m_meshColors.swap(scene.meshColors);
+    m_models.swap(scene.models);
+    m_instances.swap(scene.instances);
+    if(!scene.lights.empty())
+    {
+        m_lights.swap(scene.lights);
+    }
+    if(!scene.texture.isEmpty())
+    {
+        loadTexture(scene.texture);
+    }
 
-                    if(phi + m_phiRot > M_PI)
-                    {
-                        phi = phi + m_phiRot - 2*M_PI;
-                    }
-                    else
-                    {
-                        phi = phi + m_phiRot;
-                    }
-                    Color texCol = getTextureValue(phi, theta);
-                    Material sphMat = m_spheres[indices[0]]->getMaterial();
-                    sphMat.setDiffuse(Vec3d(texCol.r,texCol.g, texCol.b));
+    //A rebuild for the old spheres is of no use anymore
+    m_bvhPool.waitForDone();
+    m_bvhBuilder.discard();
+    m_sphereBvh.clear();
 
-                    setPoint(Point2D(x - TEX_HALF_X, y - TEX_HALF_Y), getTextureValue(phi, theta));
-                    //setPoint(Point2D(x - TEX_HALF_X, y - TEX_HALF_Y), phong(hits[0], eye, normal, m_light, sphMat));
-                }
-            }
-        }
+    m_sceneGraph.clear();
+    m_sphereNodes.clear();
+    m_nodeSpheres.clear();
+    for(int i=0; i<m_sphereCount; i++)
+    {
+        addSphereNode(i, scene.sphereParents[i], scene.orbitAxes[i], scene.orbitSpeeds[i]);
     }
+    updateScene();
 }
 
-Color GLBox::phong(Vec3d hit, Vec3d eyePos, Vec3d normal, Light light, Material Material)
+bool GLBox::renderFrame(unsigned char *target, double &renderScale)
 {
-    Vec3d color = Vec3d(0,0,0);
+    Scene scene;
+
+    //Take over the input posted by the GUI
+    m_stateMutex.lock();
+    m_state = m_posted;
+    int steps = m_pendingSteps;
+    m_pendingSteps = 0;
+    bool sceneChanged = m_scenePending;
+    if(sceneChanged)
+    {
+        scene.swap(m_pendingScene);
+        m_scenePending = false;
+    }
+    bool compare = m_compareRequested;
+    m_compareRequested = false;
+    bool changed = m_inputVersion != m_renderedVersion || sceneChanged || compare;
+    m_renderedVersion = m_inputVersion;
+    m_stateMutex.unlock();
 
-    //Light ray (L)
-    Vec3d lightRay = light.getPosition() - hit;
-    lightRay.norm();
+    if(sceneChanged)
+    {
+        installScene(scene);
+    }
+    if(steps > 0)
+    {
+        m_sceneGraph.animate(steps);
+        updateScene();
+        changed = changed || !m_sceneGraph.getChangedNodes().empty();
+    }
 
-    //Diffuse light
-    double diffuse = normal * lightRay;
-    if(diffuse<0)
+    //Once the input is idle, a frame of reduced quality is replaced by a full quality one
+    bool refine = !changed && m_frameReduced;
+    if(!changed && !refine)
     {
-        diffuse = 0;
+        return false;
     }
 
-    //Specular light
-    //Blinn-Phong
-//    Vec3d halfway = lightRay + eyePos;    //halfway = H
-//    for(int i=0; i<3; i++) { halfway(i) = halfway(i)/2; }
-//    double specular = normal * halfway;
-    Vec3d reflec = normal * (normal * lightRay) * 2 - lightRay;    //reflect = R
-    double specular = reflec * eyePos;
-    if(specular<0)
+    m_buffer = target;
+
+    //Resolution and shadows chosen from the frame times so far
+    if(m_resolution.getTargetFrameTime() != m_state.targetFrameTime)
     {
-        specular = 0;
+        m_resolution.setTargetFrameTime(m_state.targetFrameTime);
     }
+    renderScale = refine ? 1.0 : m_resolution.getScale();
+    m_renderWidth = round(TEX_RES_X*renderScale);
+    m_renderHeight = round(TEX_RES_Y*renderScale);
+    m_renderShadows = refine || m_resolution.getShadows();
+    m_frameReduced = renderScale < 1.0 || !m_renderShadows;
 
-    //Ambient light
-    Vec3d ambient = Material.getAmbient();
+    if(compare)
+    {
+        m_comparePassed = runFastMathComparison();
+    }
+
+    QElapsedTimer frameTimer;
+    frameTimer.start();
+    qint64 traceStart = m_trace.now();
+    m_frameStats = RayStats();
+    bool completed = true;
+    if(m_state.preview)
+    {
+        rasterize();
+    }
+    else
+    {
+        completed = raycast();
+    }
 
+    //Cancelled frames count as well, otherwise frames too slow to finish never lower the resolution
+    double frameTime = frameTimer.nsecsElapsed() / 1.0e6;
+    if(!completed)
+    {
+        frameTime = estimateFrameTime(frameTime);
+    }
+    if(!refine && m_resolution.addFrameTime(frameTime))
+    {
+        qDebug() << "Render scale" << m_resolution.getScale() << "shadows" << m_resolution.getShadows()
+                 << "average frame time" << m_resolution.getAverageFrameTime() << "ms";
+    }
 
-    //Addition of lights to color vector
-    color += (Material.getDiffuse() & light.getLightColor()) * diffuse;
+    if(!completed)
+    {
+        //Newer input arrived, the render thread starts its frame right away.
+        //The stage times of the cancelled frame must not end up in the next one.
+        m_cancelledFrames++;
+        m_profiler.discardFrame();
+        return false;
+    }
+    m_cancelledFrames = 0;
+
+    if(m_trace.isOpen())
+    {
+        m_trace.addSpan("frame", traceStart, m_trace.now(), &m_frameStats);
+        m_trace.addCounters("rays", traceStart, m_frameStats);
+        m_trace.flush();
+    }
 
-    color += (Material.getSpecular() & light.getLightColor()) * (double) pow((double) specular, Material.getShininess());
+    if(m_state.overlays)
+    {
+        drawOverlays();
+    }
 
-    color += ambient & light.getAmbient();
+    if(m_profiler.isEnabled())
+    {
+        m_profiler.addStats(m_frameStats);
+        m_profiler.endFrame();
+        drawProfileOverlay();
+    }
 
+    return true;
+}
 
-    for(int i=0; i<3; i++){
-        if(color(i) > 1)
-            color(i) = 1;
+bool GLBox::raycast()
+{
+    clearImage(Color(1.0, 1.0, 1.0));
+
+    //The workers take the tiles row by row from m_nextTile
+    m_tilesX = (m_renderWidth + TILE_SIZE - 1) / TILE_SIZE;
+    m_tileCount = m_tilesX * ((m_renderHeight + TILE_SIZE - 1) / TILE_SIZE);
+    binSpheres();
+    m_nextTile = 0;
+    m_antialiasPass = false;
+    for(unsigned int i=0; i<m_tileWorkers.size(); i++)
+    {
+        m_tileWorkers[i]->reset();
+        m_tilePool.start(m_tileWorkers[i]);
     }
+    m_tilePool.waitForDone();
 
-    Color color2;
-    color2.r = color(0);
-    color2.g = color(1);
-    color2.b = color(2);
+    //Tiles are only dropped when newer input arrived, then the frame is incomplete
+    bool completed = int(m_nextTile) >= m_tileCount;
 
-    return color2;
+    //Edges are found across tile borders, so refining starts when all tiles are cast.
+    //A superseded frame is shown without the remaining refinement.
+    if(completed && m_state.antialiasing && !isSuperseded())
+    {
+        m_nextTile = 0;
+        m_antialiasPass = true;
+        for(unsigned int i=0; i<m_tileWorkers.size(); i++)
+        {
+            m_tilePool.start(m_tileWorkers[i]);
+        }
+        m_tilePool.waitForDone();
+    }
+
+    for(unsigned int i=0; i<m_tileWorkers.size(); i++)
+    {
+        m_frameStats += m_tileWorkers[i]->getStats();
+        for(int s=0; s<STAGE_TEXTURE_UPLOAD; s++)
+        {
+            m_profiler.add(ProfileStage(s), m_tileWorkers[i]->getStageTimes()[s]);
+        }
+    }
+
+    if(!completed)
+    {
+        return false;
+    }
+
+    extendBorder();
+    return true;
 }
 
-bool GLBox::isShadowed(sphere *sphere, Vec3d hit, Light light)
+void GLBox::binSpheres()
 {
-    //Light ray (L)
-    Vec3d lightRay = light.getPosition() - hit;
-    lightRay.norm();
+    int tilesY = m_tileCount / m_tilesX;
+    double focus = m_state.focus;
+    m_sphereTiles.resize(4*m_sphereCount);
+    m_tileSphereStart.assign(m_tileCount + 1, 0);
 
     for(int i=0; i<m_sphereCount; i++)
     {
-        if(m_spheres[i] != sphere)
+        int *tiles = &m_sphereTiles[4*i];
+        Vec4d center = m_spheres[i].getCenter();
+        double radius = m_spheres[i].getRadius();
+
+        //Distance in front of the eye along the view axis, the ray of a pixel x points along (sx, sy, -focus)
+        double depth = focus - center(2);
+        if(focus <= 0 || depth <= radius)
         {
-            Vec3d intersect = m_spheres[i]->intersect(hit, lightRay);
-            if(intersect(2) != -INFINITY)
+            tiles[0] = 0;
+            tiles[1] = 0;
+            tiles[2] = m_tilesX - 1;
+            tiles[3] = tilesY - 1;
+        }
+        else
+        {
+            //Slopes of the tangents from the eye to the sphere in the xz and yz plane
+            double bounds[4];
+            double d2 = depth*depth - radius*radius;
+            for(int axis=0; axis<2; axis++)
+            {
+                double c = center(axis);
+                double root = radius*sqrt(c*c + d2);
+                bounds[axis] = focus*(c*depth - root) / d2;
+                bounds[axis+2] = focus*(c*depth + root) / d2;
+            }
+
+            //Screen coordinates -1..1 to pixels, widened by a pixel against rounding
+            double sizes[2] = { m_renderWidth - 1.0, m_renderHeight - 1.0 };
+            int maxTiles[2] = { m_tilesX - 1, tilesY - 1 };
+            for(int j=0; j<4; j++)
+            {
+                double pixel = (bounds[j] + 1)*0.5*sizes[j%2] + (j < 2 ? -1 : 1);
+                pixel = std::max(-1.0, std::min(pixel, sizes[j%2] + 1));
+                tiles[j] = std::max(0, std::min(int(floor(pixel)) / TILE_SIZE, maxTiles[j%2]));
+            }
+
+            //Completely off screen
+            if(bounds[2] < -1 - 2/sizes[0] || bounds[0] > 1 + 2/sizes[0] ||
+               bounds[3] < -1 - 2/sizes[1] || bounds[1] > 1 + 2/sizes[1])
             {
-                return true;
+                tiles[2] = tiles[0] - 1;
+            }
+        }
+
+        for(int ty = tiles[1]; ty <= tiles[3]; ty++)
+        {
+            for(int tx = tiles[0]; tx <= tiles[2]; tx++)
+            {
+                m_tileSphereStart[ty*m_tilesX + tx + 1]++;
             }
         }
     }
-    return false;
-}
 
-void GLBox::loadTexture(QString filename)
-{
-    if(!m_texture.load(filename))
+    //Counts to offsets, then the spheres are filled in ascending order
+    for(int t=0; t<m_tileCount; t++)
     {
-        qDebug() << "Loading image " << filename << " failed";
-        return;
+        m_tileSphereStart[t+1] += m_tileSphereStart[t];
+    }
+    m_tileSpheres.resize(m_tileSphereStart[m_tileCount]);
+    std::vector<int> next(m_tileSphereStart.begin(), m_tileSphereStart.end() - 1);
+    for(int i=0; i<m_sphereCount; i++)
+    {
+        const int *tiles = &m_sphereTiles[4*i];
+        for(int ty = tiles[1]; ty <= tiles[3]; ty++)
+        {
+            for(int tx = tiles[0]; tx <= tiles[2]; tx++)
+            {
+                m_tileSpheres[next[ty*m_tilesX + tx]++] = i;
+            }
+        }
     }
 }
 
-Color GLBox::getTextureValue(double phi, double theta)
+void GLBox::extendBorder()
 {
-    if(phi < -M_PI || phi > M_PI)
+    //Repeat the last rendered column and row, so linear filtering at the border
+    //of a reduced resolution frame does not blend in unrendered pixels
+    if(m_renderWidth < TEX_RES_X)
     {
-        qDebug() << "phi = " << phi << " out of scope!";
-        return Color();
+        for(int y = 0; y < m_renderHeight; y++)
+        {
+            memcpy(&m_buffer[3*TO_LINEAR(m_renderWidth, y)], &m_buffer[3*TO_LINEAR(m_renderWidth-1, y)], 3);
+        }
     }
-    if(theta < 0.0 || theta > M_PI)
+    if(m_renderHeight < TEX_RES_Y)
     {
-        qDebug() << "theta = " << theta << " out of scope!";
-        return Color();
+        int width = std::min(m_renderWidth + 1, TEX_RES_X);
+        memcpy(&m_buffer[3*TO_LINEAR(0, m_renderHeight)], &m_buffer[3*TO_LINEAR(0, m_renderHeight-1)], 3*width);
     }
-
-    int u_tex = round(((phi + M_PI)/(2*M_PI)) * (m_texture.width()-1));
-    int v_tex = round((theta/M_PI) * (m_texture.height()-1));
-    QRgb color = m_texture.pixel(u_tex, v_tex);
-    Color result(qRed(color)/255.0, qGreen(color)/255.0, qBlue(color)/255.0);
-    return result;
 }
 
-int GLBox::round(double dnumber)
+bool GLBox::rasterize()
 {
-    return (int) floor(dnumber+0.5);
-}
+    clearImage(Color(1.0, 1.0, 1.0));
 
-//Koordinaten anpassen: z=point(1), x=point(0), y=-point(2)
-double GLBox::getPhi(Vec3d point)
+    //The preview stands in for the ray cast frame, so it uses the eye and pixel mapping of the
+    //ray caster instead of the camera. The projection does not mirror, front faces stay CCW.
+    m_previewProjMat = makePrimaryProjMat(m_renderWidth, m_renderHeight, m_state.focus);
+    m_rasterizer.setTarget(m_buffer, m_renderWidth, m_renderHeight, TEX_RES_X);
+    m_rasterizer.setFrontFace(true);
+    m_rasterizer.beginFrame();
+
+    for(int i=0; i<m_sphereCount; i++)
+    {
+        rasterizeSphere(m_spheres[i]);
+    }
+
+    //Cuboids, eight corners each in the order of initializeCuboids()
+    const std::vector<Vec4d> &corners = m_cuboids.getVertices();
+    for(unsigned int i=0; i+8<=corners.size(); i+=8)
+    {
+        rasterizeCuboid(&corners[i]);
+    }
+
+    //Binning and rasterization run on the tile pool of the ray caster
+    m_rasterizer.endFrame(&m_tilePool);
+
+    extendBorder();
+    return true;
+}
+
+void GLBox::rasterizeSphere(sphere &sph)
+{
+    const Mat4d &viewProj = m_previewProjMat;
+    Vec4d center = sph.getCenter();
+    double radius = sph.getRadius();
+
+    //Tessellation level from the projected radius
+    int segments = RASTER_MAX_SEGMENTS;
+    Vec4d projCenter = viewProj*center;
+    if(projCenter(3) > RASTER_NEAR_W)
+    {
+        double projRadius = radius / projCenter(3) * 0.5*std::max(m_renderWidth, m_renderHeight);
+        segments = int(2*M_PI*projRadius / RASTER_SEGMENT_LENGTH);
+        segments = std::max(RASTER_MIN_SEGMENTS, std::min(RASTER_MAX_SEGMENTS, segments));
+    }
+    int rings = segments / 2;
+
+    //Vertex grid over theta (rings) and phi (segments), the seam is duplicated
+    Material mat = sph.getMaterial();
+    m_rasterVertices.resize((rings + 1)*(segments + 1));
+    for(int i=0; i<=rings; i++)
+    {
+        double theta = M_PI*i / rings;
+        for(int j=0; j<=segments; j++)
+        {
+            double phi = 2*M_PI*j / segments;
+            Vec3d normal(sin(theta)*cos(phi), sin(theta)*sin(phi), cos(theta));
+            Vec4d pos(center(0) + radius*normal(0), center(1) + radius*normal(1), center(2) + radius*normal(2), 1);
+
+            RasterVertex &vertex = m_rasterVertices[i*(segments + 1) + j];
+            vertex.pos = viewProj*pos;
+            vertex.color = previewColor(Vec3d(pos(0), pos(1), pos(2)), normal, mat);
+        }
+    }
+
+    //Counter-clockwise seen from outside
+    for(int i=0; i<rings; i++)
+    {
+        for(int j=0; j<segments; j++)
+        {
+            int v00 = i*(segments + 1) + j;
+            int v10 = v00 + segments + 1;
+            m_rasterizer.drawTriangle(m_rasterVertices[v00], m_rasterVertices[v10], m_rasterVertices[v10 + 1]);
+            m_rasterizer.drawTriangle(m_rasterVertices[v00], m_rasterVertices[v10 + 1], m_rasterVertices[v00 + 1]);
+        }
+    }
+}
+
+void GLBox::rasterizeCuboid(const Vec4d *cub)
+{
+    static const int faces[6][4] = {
+        {0, 1, 2, 3}, {4, 5, 6, 7}, {0, 1, 5, 4},
+        {1, 2, 6, 5}, {2, 3, 7, 6}, {3, 0, 4, 7}
+    };
+
+    const Mat4d &viewProj = m_previewProjMat;
+    Vec3d center(0, 0, 0);
+    for(int i=0; i<8; i++)
+    {
+        center += Vec3d(cub[i](0), cub[i](1), cub[i](2)) * 0.125;
+    }
+    Material mat(Vec3d(0.6, 0.6, 0.6), Vec3d(0, 0, 0), Vec3d(0.2, 0.2, 0.2), 0.0);
+
+    RasterVertex quad[4];
+    for(int f=0; f<6; f++)
+    {
+        Vec3d p[4];
+        for(int i=0; i<4; i++)
+        {
+            p[i] = Vec3d(cub[faces[f][i]](0), cub[faces[f][i]](1), cub[faces[f][i]](2));
+        }
+        Vec3d normal = Vec3d(p[1] - p[0]).cross(p[2] - p[0]).norm();
+
+        //Flat shaded, wound counter-clockwise seen from outside
+        bool outward = normal * (p[0] - center) > 0;
+        if(!outward)
+        {
+            normal = normal * -1.0;
+        }
+        Vec3d faceCenter = (p[0] + p[1] + p[2] + p[3]) * 0.25;
+        Vec3d color = previewColor(faceCenter, normal, mat);
+        for(int i=0; i<4; i++)
+        {
+            int v = outward ? i : 3 - i;
+            quad[i].pos = viewProj*cub[faces[f][v]];
+            quad[i].color = color;
+        }
+        m_rasterizer.drawTriangle(quad[0], quad[1], quad[2]);
+        m_rasterizer.drawTriangle(quad[0], quad[2], quad[3]);
+    }
+}
+
+Vec3d GLBox::previewColor(Vec3d pos, Vec3d normal, Material mat)
+{
+    Vec3d color = mat.getAmbient();
+    for(unsigned int l=0; l<m_lights.size(); l++)
+    {
+        Vec3d lightRay = m_lights[l].getPosition() - pos;
+        double attenuation = m_lights[l].getAttenuation(lightRay.length());
+        double diffuse = normal * lightRay.norm();
+        if(attenuation > 0 && diffuse > 0)
+        {
+            color += (mat.getDiffuse() & m_lights[l].getLightColor()) * (diffuse*attenuation);
+        }
+    }
+    return color;
+}
+
+// Hash of a pixel and a sample to [0, 1), the samples stay the same from frame to frame
+static inline double sampleJitter(int x, int y, int sample)
+{
+    unsigned int h = unsigned(x)*73856093u ^ unsigned(y)*19349663u ^ unsigned(sample)*83492791u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    return (h & 0xffffff) / double(0x1000000);
+}
+
+void GLBox::raycastTiles(TileWorker &worker)
+{
+    Vec3d eye(0, 0, m_state.focus);
+    forever
+    {
+        //Tiles of a superseded frame are dropped, so the newest frame can start right away
+        if(isSuperseded())
+        {
+            return;
+        }
+        int tile = m_nextTile.fetchAndAddRelaxed(1);
+        if(tile >= m_tileCount)
+        {
+            return;
+        }
+        if(m_antialiasPass)
+        {
+            antialiasTile((tile % m_tilesX)*TILE_SIZE, (tile / m_tilesX)*TILE_SIZE, eye, worker);
+        }
+        else
+        {
+            raycastTile((tile % m_tilesX)*TILE_SIZE, (tile / m_tilesX)*TILE_SIZE, eye, worker);
+        }
+    }
+}
+
+bool GLBox::isSuperseded()
+{
+    return m_cancelledFrames < MAX_CANCELLED_FRAMES && int(m_inputVersion) != m_renderedVersion;
+}
+
+double GLBox::estimateFrameTime(double elapsed)
+{
+    //Only the first pass is cancelled, m_nextTile counts its tiles
+    int tiles = std::min(int(m_nextTile), m_tileCount);
+    if(tiles == 0 || tiles >= m_tileCount)
+    {
+        return elapsed;
+    }
+    return elapsed * m_tileCount / tiles;
+}
+
+void GLBox::raycastTile(int x0, int y0, Vec3d eye, TileWorker &worker)
+{
+    int x1 = std::min(x0 + TILE_SIZE, m_renderWidth);
+    int y1 = std::min(y0 + TILE_SIZE, m_renderHeight);
+
+    Vec3d viewDirs[TILE_SIZE*TILE_SIZE];
+    Vec3d hits[TILE_SIZE*TILE_SIZE];
+    int hitObjects[TILE_SIZE*TILE_SIZE];     // Sphere or m_sphereCount + mesh instance, -1 if none
+    int hitTriangles[TILE_SIZE*TILE_SIZE];
+    Vec3d boundsMin(INFINITY, INFINITY, INFINITY);
+    Vec3d boundsMax(-INFINITY, -INFINITY, -INFINITY);
+    bool anyHit = false;
+    qint64 traceStart = m_trace.isOpen() ? m_trace.now() : 0;
+    RayStats stats;
+    stats.primaryRays = (x1 - x0)*(y1 - y0);
+
+    //Only the spheres whose projected bounds overlap the tile are tested (see binSpheres())
+    int tile = (y0 / TILE_SIZE)*m_tilesX + x0 / TILE_SIZE;
+    int candidateStart = m_tileSphereStart[tile];
+    int candidateEnd = m_tileSphereStart[tile+1];
+    stats.sphereTests = stats.primaryRays*(candidateEnd - candidateStart);
+
+    //The tile is processed stage by stage, so each stage can be timed as a whole (see profiler.h)
+    {
+        ScopedTimer timer(m_profiler, STAGE_RAY_GENERATION, worker.getStageTimes());
+        for(int y = y0; y < y1; y++)
+        {
+            for(int x = x0; x < x1; x++)
+            {
+                // Construct the ray for the pixel (i,j)
+                Vec3d viewDir = makePrimaryRay(x, y, m_renderWidth, m_renderHeight, m_state.focus);
+                // Normalize the view direction!
+                viewDirs[(y - y0)*TILE_SIZE + (x - x0)] = viewDir.norm();
+            }
+        }
+    }
+
+    //Primary rays: closest hit of each pixel and the bounding box of all hits in the tile
+    {
+        ScopedTimer timer(m_profiler, STAGE_INTERSECTION, worker.getStageTimes());
+        for(int y = y0; y < y1; y++)
+        {
+            for(int x = x0; x < x1; x++)
+            {
+                int p = (y - y0)*TILE_SIZE + (x - x0);
+                hits[p] = Vec3d(0, 0, -INFINITY);
+                hitObjects[p] = -1;
+
+                //The closest hit is the one with the largest z
+                for(int c = candidateStart; c < candidateEnd; c++)
+                {
+                    int i = m_tileSpheres[c];
+                    Vec3d hit = m_spheres[i].intersect(eye, viewDirs[p]);
+                    if(hit(2) > hits[p](2))
+                    {
+                        hits[p] = hit;
+                        hitObjects[p] = i;
+                    }
+                }
+                intersectInstances(eye, viewDirs[p], hits[p], hitObjects[p], hitTriangles[p], stats);
+
+                if(hitObjects[p] >= 0)
+                {
+                    anyHit = true;
+                    stats.hits++;
+                    for(int i=0; i<3; i++)
+                    {
+                        boundsMin(i) = std::min(boundsMin(i), hits[p](i));
+                        boundsMax(i) = std::max(boundsMax(i), hits[p](i));
+                    }
+                }
+            }
+        }
+    }
+
+    if(!anyHit)
+    {
+        if(m_state.antialiasing)
+        {
+            for(int y = y0; y < y1; y++)
+            {
+                std::fill(&m_pixelObjects[TO_LINEAR(x0, y)], &m_pixelObjects[TO_LINEAR(x1, y)], -1);
+                std::fill(&m_pixelShadows[TO_LINEAR(x0, y)], &m_pixelShadows[TO_LINEAR(x1, y)], 0);
+                std::fill(&m_pixelLuma[TO_LINEAR(x0, y)], &m_pixelLuma[TO_LINEAR(x1, y)], 255);
+            }
+        }
+        recordTile(x0, y0, traceStart, stats, worker);
+        return;
+    }
+
+    //Only lights reaching the geometry of this tile are used for shading and shadow rays
+    std::vector<int> &tileLights = worker.getTileLights();
+    tileLights.clear();
+    cullLights(boundsMin, boundsMax, tileLights);
+    int lightCount = tileLights.size();
+
+    Vec3d texColors[TILE_SIZE*TILE_SIZE];
+    {
+        ScopedTimer timer(m_profiler, STAGE_TEXTURE_LOOKUP, worker.getStageTimes());
+        for(int y = y0; y < y1; y++)
+        {
+            for(int x = x0; x < x1; x++)
+            {
+                int p = (y - y0)*TILE_SIZE + (x - x0);
+                if(hitObjects[p] >= m_sphereCount)
+                {
+                    texColors[p] = m_instances[hitObjects[p] - m_sphereCount].getMaterial().getDiffuse();
+                }
+                else if(hitObjects[p] >= 0)
+                {
+                    texColors[p] = getTextureColor(hits[p]);
+                    stats.textureFetches++;
+                }
+            }
+        }
+    }
+
+    //One flag per pixel and tile light, +1 keeps the first element valid without lights
+    std::vector<char> &shadowed = worker.getTileShadows();
+    shadowed.assign(TILE_SIZE*TILE_SIZE*lightCount + 1, 0);
+    if(m_renderShadows)
+    {
+        ScopedTimer timer(m_profiler, STAGE_SHADOW_RAYS, worker.getStageTimes());
+        for(int y = y0; y < y1; y++)
+        {
+            for(int x = x0; x < x1; x++)
+            {
+                int p = (y - y0)*TILE_SIZE + (x - x0);
+                if(hitObjects[p] < 0)
+                {
+                    continue;
+                }
+                for(int l=0; l<lightCount; l++)
+                {
+                    Light &light = m_lights[tileLights[l]];
+                    if(light.getAttenuation((light.getPosition() - hits[p]).length()) > 0)
+                    {
+                        shadowed[p*lightCount + l] = isShadowed(hitObjects[p], hits[p], light, stats);
+                    }
+                }
+            }
+        }
+    }
+
+    Color colors[TILE_SIZE*TILE_SIZE];
+    {
+        ScopedTimer timer(m_profiler, STAGE_PHONG, worker.getStageTimes());
+        for(int y = y0; y < y1; y++)
+        {
+            for(int x = x0; x < x1; x++)
+            {
+                int p = (y - y0)*TILE_SIZE + (x - x0);
+                if(hitObjects[p] >= 0)
+                {
+                    colors[p] = shade(hitObjects[p], hitTriangles[p], hits[p], eye, texColors[p], tileLights, &shadowed[p*lightCount]);
+                }
+            }
+        }
+    }
+
+    //Reflection and refraction, within the share of the tile in the frame budget
+    {
+        ScopedTimer timer(m_profiler, STAGE_SECONDARY_RAYS, worker.getStageTimes());
+        int budget = getSecondaryBudget((x1 - x0)*(y1 - y0));
+
+        //Every hit pixel gets an even share of what is left, so a used up budget shortens the
+        //paths of all pixels of the tile instead of cutting off the last rows
+        int pending = 0;
+        for(int y = y0; y < y1; y++)
+        {
+            for(int x = x0; x < x1; x++)
+            {
+                if(hitObjects[(y - y0)*TILE_SIZE + (x - x0)] >= 0)
+                {
+                    pending++;
+                }
+            }
+        }
+        for(int y = y0; y < y1; y++)
+        {
+            for(int x = x0; x < x1; x++)
+            {
+                int p = (y - y0)*TILE_SIZE + (x - x0);
+                if(hitObjects[p] >= 0)
+                {
+                    int share = (budget + pending - 1) / pending;
+                    budget -= share;
+                    colors[p] = traceSecondary(hitObjects[p], hitTriangles[p], hits[p], viewDirs[p], colors[p],
+                                               share, TO_LINEAR(x, y)*(AA_STRATA*AA_STRATA + 1), worker, stats);
+                    budget += share;
+                    pending--;
+                }
+            }
+        }
+    }
+
+    {
+        ScopedTimer timer(m_profiler, STAGE_BUFFER_WRITE, worker.getStageTimes());
+        for(int y = y0; y < y1; y++)
+        {
+            for(int x = x0; x < x1; x++)
+            {
+                int p = (y - y0)*TILE_SIZE + (x - x0);
+                if(hitObjects[p] >= 0)
+                {
+                    setPoint(Point2D(x - TEX_HALF_X, y - TEX_HALF_Y), colors[p]);
+                }
+            }
+        }
+    }
+
+    //Input of the edge detection, the background is white
+    if(m_state.antialiasing)
+    {
+        ScopedTimer timer(m_profiler, STAGE_ANTIALIASING, worker.getStageTimes());
+        for(int y = y0; y < y1; y++)
+        {
+            for(int x = x0; x < x1; x++)
+            {
+                int p = (y - y0)*TILE_SIZE + (x - x0);
+                int pixel = TO_LINEAR(x, y);
+                m_pixelObjects[pixel] = hitObjects[p];
+                m_pixelShadows[pixel] = 0;
+                m_pixelLuma[pixel] = 255;
+                if(hitObjects[p] >= 0)
+                {
+                    for(int l=0; l<lightCount; l++)
+                    {
+                        m_pixelShadows[pixel] |= shadowed[p*lightCount + l] << (tileLights[l] & 7);
+                    }
+                    const unsigned char *rgb = &m_buffer[3*pixel];
+                    m_pixelLuma[pixel] = (77*rgb[0] + 150*rgb[1] + 29*rgb[2]) >> 8;
+                }
+            }
+        }
+    }
+
+    recordTile(x0, y0, traceStart, stats, worker);
+}
+
+void GLBox::antialiasTile(int x0, int y0, Vec3d eye, TileWorker &worker)
+{
+    int x1 = std::min(x0 + TILE_SIZE, m_renderWidth);
+    int y1 = std::min(y0 + TILE_SIZE, m_renderHeight);
+    RayStats stats;
+    ScopedTimer timer(m_profiler, STAGE_ANTIALIASING, worker.getStageTimes());
+
+    //The bins cover a pixel around the spheres, enough for samples half a pixel outside the tile
+    int tile = (y0 / TILE_SIZE)*m_tilesX + x0 / TILE_SIZE;
+    int candidateStart = m_tileSphereStart[tile];
+    int candidateEnd = m_tileSphereStart[tile+1];
+    int budget = getSecondaryBudget((x1 - x0)*(y1 - y0));
+
+    for(int y = y0; y < y1; y++)
+    {
+        for(int x = x0; x < x1; x++)
+        {
+            if(!isEdgePixel(x, y))
+            {
+                continue;
+            }
+            stats.refinedPixels++;
+
+            //The sample of the pixel center is kept and averaged with one sample per stratum
+            const unsigned char *rgb = &m_buffer[3*TO_LINEAR(x, y)];
+            Vec3d sum(rgb[0] / 255.0, rgb[1] / 255.0, rgb[2] / 255.0);
+            for(int s=0; s<AA_STRATA*AA_STRATA; s++)
+            {
+                double dx = ((s % AA_STRATA) + sampleJitter(x, y, 2*s)) / AA_STRATA - 0.5;
+                double dy = ((s / AA_STRATA) + sampleJitter(x, y, 2*s+1)) / AA_STRATA - 0.5;
+                Vec3d viewDir = makePrimaryRay(x + dx, y + dy, m_renderWidth, m_renderHeight, m_state.focus);
+                Color color = traceSample(eye, viewDir.norm(), candidateStart, candidateEnd,
+                                          budget, TO_LINEAR(x, y)*(AA_STRATA*AA_STRATA + 1) + s + 1, worker, stats);
+                sum += Vec3d(color.r, color.g, color.b);
+            }
+            stats.aaSamples += AA_STRATA*AA_STRATA;
+
+            Vec3d mean = sum * (1.0 / (AA_STRATA*AA_STRATA + 1));
+            setPoint(Point2D(x - TEX_HALF_X, y - TEX_HALF_Y), Color(mean(0), mean(1), mean(2)));
+        }
+    }
+
+    worker.getStats() += stats;
+}
+
+bool GLBox::isEdgePixel(int x, int y)
+{
+    static const int offsets[4][2] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+    int pixel = TO_LINEAR(x, y);
+    for(int i=0; i<4; i++)
+    {
+        int nx = x + offsets[i][0];
+        int ny = y + offsets[i][1];
+        if(nx < 0 || ny < 0 || nx >= m_renderWidth || ny >= m_renderHeight)
+        {
+            continue;
+        }
+        int neighbour = TO_LINEAR(nx, ny);
+        if(m_pixelObjects[neighbour] != m_pixelObjects[pixel] ||
+           m_pixelShadows[neighbour] != m_pixelShadows[pixel] ||
+           abs(int(m_pixelLuma[neighbour]) - int(m_pixelLuma[pixel])) > AA_CONTRAST)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+Color GLBox::traceSample(Vec3d eye, Vec3d dir, int candidateStart, int candidateEnd,
+                         int &budget, int seed, TileWorker &worker, RayStats &stats)
+{
+    Vec3d hit(0, 0, -INFINITY);
+    int object = -1;
+    int triangle = -1;
+    for(int c = candidateStart; c < candidateEnd; c++)
+    {
+        int i = m_tileSpheres[c];
+        Vec3d sphereHit = m_spheres[i].intersect(eye, dir);
+        if(sphereHit(2) > hit(2))
+        {
+            hit = sphereHit;
+            object = i;
+        }
+    }
+    stats.sphereTests += candidateEnd - candidateStart;
+    intersectInstances(eye, dir, hit, object, triangle, stats);
+    if(object < 0)
+    {
+        return Color(1.0, 1.0, 1.0);
+    }
+
+    Color local = shadeHit(object, triangle, hit, eye, worker, stats);
+    return traceSecondary(object, triangle, hit, dir, local, budget, seed, worker, stats);
+}
+
+Color GLBox::shadeHit(int object, int triangle, Vec3d hit, Vec3d eye, TileWorker &worker, RayStats &stats)
+{
+    Vec3d texColor;
+    if(object >= m_sphereCount)
+    {
+        texColor = m_instances[object - m_sphereCount].getMaterial().getDiffuse();
+    }
+    else
+    {
+        texColor = getTextureColor(hit);
+        stats.textureFetches++;
+    }
+
+    std::vector<int> &lights = worker.getSampleLights();
+    lights.clear();
+    cullLights(hit, hit, lights);
+    std::vector<char> &shadowed = worker.getSampleShadows();
+    shadowed.assign(lights.size() + 1, 0);
+    if(m_renderShadows)
+    {
+        for(unsigned int l=0; l<lights.size(); l++)
+        {
+            Light &light = m_lights[lights[l]];
+            if(light.getAttenuation((light.getPosition() - hit).length()) > 0)
+            {
+                shadowed[l] = isShadowed(object, hit, light, stats);
+            }
+        }
+    }
+    return shade(object, triangle, hit, eye, texColor, lights, &shadowed[0]);
+}
+
+int GLBox::getSecondaryBudget(int pixels)
+{
+    return int(SECONDARY_RAY_BUDGET*pixels + 0.5);
+}
+
+Color GLBox::traceSecondary(int object, int triangle, Vec3d hit, Vec3d dir, Color local,
+                            int &budget, int seed, TileWorker &worker, RayStats &stats)
+{
+    Material material = getObjectMaterial(object);
+    if(material.getReflection() <= 0 && material.getTransparency() <= 0)
+    {
+        return local;
+    }
+
+    //Depth first with an explicit stack instead of recursion, each ray adds at most two
+    SecondaryRay stack[2*(SECONDARY_MAX_DEPTH + 1)];
+    int stackSize = 0;
+    Vec3d color(0, 0, 0);
+    pushSecondaryRays(object, triangle, hit, dir, Vec3d(local.r, local.g, local.b), Vec3d(1, 1, 1), 1, stack, stackSize, color);
+
+    for(int popped = 0; stackSize > 0; popped++)
+    {
+        SecondaryRay ray = stack[--stackSize];
+
+        //Russian roulette, the surviving rays are weighted up so the expected color stays the same
+        double importance = std::max(ray.weight(0), std::max(ray.weight(1), ray.weight(2)));
+        if(importance < SECONDARY_ROULETTE_WEIGHT)
+        {
+            double survival = importance / SECONDARY_ROULETTE_WEIGHT;
+            if(sampleJitter(seed, popped, 0) >= survival)
+            {
+                continue;
+            }
+            ray.weight = ray.weight * (1.0 / survival);
+        }
+
+        //Once the budget is used up, surfaces keep their local color
+        if(budget <= 0)
+        {
+            color += ray.weight & ray.fallback;
+            continue;
+        }
+        budget--;
+        stats.secondaryRays++;
+
+        Vec3d nextHit;
+        int nextObject, nextTriangle;
+        if(!intersectNearest(ray.origin, ray.dir, nextHit, nextObject, nextTriangle, stats))
+        {
+            color += ray.weight;    //White background
+            continue;
+        }
+        Color nextLocal = shadeHit(nextObject, nextTriangle, nextHit, ray.origin, worker, stats);
+        pushSecondaryRays(nextObject, nextTriangle, nextHit, ray.dir, Vec3d(nextLocal.r, nextLocal.g, nextLocal.b),
+                          ray.weight, ray.depth + 1, stack, stackSize, color);
+    }
+
+    Color result;
+    result.r = std::min(color(0), 1.0);
+    result.g = std::min(color(1), 1.0);
+    result.b = std::min(color(2), 1.0);
+    return result;
+}
+
+void GLBox::pushSecondaryRays(int object, int triangle, Vec3d hit, Vec3d dir, Vec3d local, Vec3d weight, int depth,
+                              SecondaryRay *stack, int &stackSize, Vec3d &color)
+{
+    Material material = getObjectMaterial(object);
+    double reflection = material.getReflection();
+    double transparency = material.getTransparency();
+    if(depth > SECONDARY_MAX_DEPTH)
+    {
+        reflection = 0;
+        transparency = 0;
+    }
+
+    //Normal on the side the ray comes from
+    Vec3d normal = getObjectNormal(object, triangle, hit);
+    double cosIn = -(dir * normal);
+    bool entering = cosIn > 0;
+    if(!entering)
+    {
+        normal = -normal;
+        cosIn = -cosIn;
+    }
+
+    //Snell's law, with total internal reflection the refracted share is reflected
+    Vec3d refracted;
+    if(transparency > 0)
+    {
+        double eta = entering ? 1.0 / material.getRefractiveIndex() : material.getRefractiveIndex();
+        double k = 1 - eta*eta*(1 - cosIn*cosIn);
+        if(k < 0)
+        {
+            reflection += transparency;
+            transparency = 0;
+        }
+        else
+        {
+            refracted = dir*eta + normal*(eta*cosIn - sqrt(k));
+        }
+    }
+
+    color += (weight & local) * std::max(0.0, 1 - reflection - transparency);
+
+    //Every bounce leaves at most one ray waiting, so the stack of traceSecondary() cannot overflow
+    if(reflection > 0)
+    {
+        SecondaryRay &ray = stack[stackSize++];
+        ray.origin = hit;
+        ray.dir = dir + normal*(2*cosIn);
+        ray.weight = weight * reflection;
+        ray.fallback = local;
+        ray.depth = depth;
+    }
+    if(transparency > 0)
+    {
+        SecondaryRay &ray = stack[stackSize++];
+        ray.origin = hit;
+        ray.dir = refracted;
+        ray.weight = weight * transparency;
+        ray.fallback = local;
+        ray.depth = depth;
+    }
+}
+
+bool GLBox::intersectNearest(Vec3d origin, Vec3d dir, Vec3d &hit, int &object, int &triangle, RayStats &stats)
+{
+    double t = INFINITY;
+    object = m_sphereBvh.intersect(origin, dir, SECONDARY_EPSILON, t, m_spheres, stats.sphereTests);
+    triangle = -1;
+
+    for(unsigned int i=0; i<m_instances.size(); i++)
+    {
+        MeshInstance &instance = m_instances[i];
+        if(!instance.hitsBounds(origin, dir, t))
+        {
+            continue;
+        }
+        Vec3d objOrigin, objDir;
+        instance.toObject(origin, dir, objOrigin, objDir);
+        double meshT = t;
+        int tri = m_models[instance.getMesh()].intersect(objOrigin, objDir, SECONDARY_EPSILON, meshT, stats.triangleTests);
+        if(tri >= 0)
+        {
+            t = meshT;
+            object = m_sphereCount + i;
+            triangle = tri;
+        }
+    }
+
+    if(object < 0)
+    {
+        return false;
+    }
+    hit = origin + dir*t;
+    return true;
+}
+
+void GLBox::recordTile(int x0, int y0, qint64 traceStart, const RayStats &stats, TileWorker &worker)
 {
-    double phi = atan2(-point(2),point(0));
+    worker.getStats() += stats;
+    if(m_trace.isOpen())
+    {
+        m_trace.addSpan("tile", traceStart, m_trace.now(), &stats, x0, y0);
+    }
+}
+
+void GLBox::cullLights(Vec3d boundsMin, Vec3d boundsMax, std::vector<int> &lights)
+{
+    for(unsigned int l=0; l<m_lights.size(); l++)
+    {
+        double radius = m_lights[l].getRadius();
+        if(radius == INFINITY)
+        {
+            lights.push_back(l);
+            continue;
+        }
+
+        //Squared distance between the light and the bounding box
+        Vec3d pos = m_lights[l].getPosition();
+        double dist2 = 0;
+        for(int i=0; i<3; i++)
+        {
+            double d = std::max(boundsMin(i) - pos(i), std::max(0.0, pos(i) - boundsMax(i)));
+            dist2 += d*d;
+        }
+        if(dist2 < radius*radius)
+        {
+            lights.push_back(l);
+        }
+    }
+}
+
+Vec3d GLBox::getTextureColor(Vec3d hit)
+{
+    double phi = getPhi(hit);
+    double theta = getTheta(hit);
+
+    if(phi + m_state.phiRot > M_PI)
+    {
+        phi = phi + m_state.phiRot - 2*M_PI;
+    }
+    else
+    {
+        phi = phi + m_state.phiRot;
+    }
+    Color texCol = getTextureValue(phi, theta);
+    return Vec3d(texCol.r, texCol.g, texCol.b);
+}
+
+void GLBox::intersectInstances(Vec3d origin, Vec3d dir, Vec3d &hit, int &object, int &triangle, RayStats &stats)
+{
+    for(unsigned int i=0; i<m_instances.size(); i++)
+    {
+        MeshInstance &instance = m_instances[i];
+        if(!instance.hitsBounds(origin, dir, INFINITY))
+        {
+            continue;
+        }
+
+        //The mesh is shared, the ray is moved into its object space instead
+        Vec3d objOrigin, objDir;
+        instance.toObject(origin, dir, objOrigin, objDir);
+        double t = INFINITY;
+        int tri = m_models[instance.getMesh()].intersect(objOrigin, objDir, MESH_EPSILON, t, stats.triangleTests);
+        if(tri >= 0)
+        {
+            Vec3d meshHit = origin + dir*t;
+            if(meshHit(2) > hit(2))
+            {
+                hit = meshHit;
+                object = m_sphereCount + i;
+                triangle = tri;
+            }
+        }
+    }
+}
+
+Material GLBox::getObjectMaterial(int object)
+{
+    if(object < m_sphereCount)
+    {
+        return m_spheres[object].getMaterial();
+    }
+    return m_instances[object - m_sphereCount].getMaterial();
+}
+
+Vec3d GLBox::getObjectNormal(int object, int triangle, Vec3d hit)
+{
+    if(object < m_sphereCount)
+    {
+        Vec3d normal = hit - m_spheres[object].getCenter3();
+        return normal.norm();
+    }
+    MeshInstance &instance = m_instances[object - m_sphereCount];
+    return instance.normalToWorld(m_models[instance.getMesh()].getNormal(triangle));
+}
+
+Color GLBox::shade(int object, int triangle, Vec3d hit, Vec3d eye, Vec3d texColor, const std::vector<int> &lights, const char *shadowed)
+{
+    Vec3d color(0, 0, 0);
+    Material sphMat = getObjectMaterial(object);
+    Vec3d ambientSphere = sphMat.getAmbient();
+
+    Vec3d normal = getObjectNormal(object, triangle, hit);
+
+    sphMat.setDiffuse(texColor);
+
+    for(unsigned int l=0; l<lights.size(); l++)
+    {
+        Light &light = m_lights[lights[l]];
+        Vec3d lightRay = light.getPosition() - hit;
+        double attenuation = light.getAttenuation(lightRay.length());
+        if(attenuation <= 0)
+        {
+            continue;
+        }
+
+        if(shadowed[l])
+        {
+            color += (light.getAmbient() & ambientSphere) * attenuation;
+        }
+        else
+        {
+            Color phongCol = phong(hit, eye, normal, light, sphMat);
+            color += Vec3d(phongCol.r, phongCol.g, phongCol.b) * attenuation;
+        }
+    }
+
+    Color result;
+    result.r = std::min(color(0), 1.0);
+    result.g = std::min(color(1), 1.0);
+    result.b = std::min(color(2), 1.0);
+    return result;
+}
+
+Color GLBox::phong(Vec3d hit, Vec3d eyePos, Vec3d normal, Light light, Material Material)
+{
+    Vec3d color = Vec3d(0,0,0);
+
+    //Light ray (L) and view ray (V)
+    Vec3d lightRay = light.getPosition() - hit;
+    lightRay = lightRay.norm();
+    Vec3d viewRay = eyePos - hit;
+    viewRay = viewRay.norm();
+
+    //Diffuse light
+    double diffuse = normal * lightRay;
+    if(diffuse<0)
+    {
+        diffuse = 0;
+    }
+
+    //Specular light
+    //Blinn-Phong
+//    Vec3d halfway = lightRay + eyePos;    //halfway = H
+//    for(int i=0; i<3; i++) { halfway(i) = halfway(i)/2; }
+//    double specular = normal * halfway;
+    Vec3d reflec = normal * (normal * lightRay) * 2 - lightRay;    //reflect = R
+    double specular = reflec * viewRay;
+    if(specular<0)
+    {
+        specular = 0;
+    }
+
+    //Ambient light
+    Vec3d ambient = Material.getAmbient();
+
+
+    //Addition of lights to color vector
+    color += (Material.getDiffuse() & light.getLightColor()) * diffuse;
+
+    double specularPow = m_state.fastMath ? fastPow(specular, Material.getShininess()) : pow(specular, Material.getShininess());
+    color += (Material.getSpecular() & light.getLightColor()) * specularPow;
+
+    color += ambient & light.getAmbient();
+
+
+    for(int i=0; i<3; i++){
+        if(color(i) > 1)
+            color(i) = 1;
+    }
+
+    Color color2;
+    color2.r = color(0);
+    color2.g = color(1);
+    color2.b = color(2);
+
+    return color2;
+}
+
+bool GLBox::isShadowed(int object, Vec3d hit, Light light, RayStats &stats)
+{
+    //Light ray (L)
+    Vec3d lightRay = light.getPosition() - hit;
+    lightRay.norm();
+    stats.shadowRays++;
+
+    if(m_sphereBvh.occluded(hit, lightRay, object, m_spheres, stats.sphereTests))
+    {
+        return true;
+    }
+
+    //lightRay reaches the light at t = 1, meshes only shadow in between
+    double tMin = MESH_EPSILON / lightRay.length();
+    for(unsigned int i=0; i<m_instances.size(); i++)
+    {
+        MeshInstance &instance = m_instances[i];
+        if(!instance.hitsBounds(hit, lightRay, 1.0))
+        {
+            continue;
+        }
+        Vec3d objOrigin, objDir;
+        instance.toObject(hit, lightRay, objOrigin, objDir);
+        if(m_models[instance.getMesh()].occluded(objOrigin, objDir, tMin, 1.0, stats.triangleTests))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void GLBox::loadTexture(QString filename)
+{
+    if(!m_texture.load(filename))
+    {
+        qDebug() << "Loading image " << filename << " failed";
+        return;
+    }
+}
+
+Color GLBox::getTextureValue(double phi, double theta)
+{
+    if(phi < -M_PI || phi > M_PI)
+    {
+        qDebug() << "phi = " << phi << " out of scope!";
+        return Color();
+    }
+    if(theta < 0.0 || theta > M_PI)
+    {
+        qDebug() << "theta = " << theta << " out of scope!";
+        return Color();
+    }
+
+    int u_tex = round(((phi + M_PI)/(2*M_PI)) * (m_texture.width()-1));
+    int v_tex = round((theta/M_PI) * (m_texture.height()-1));
+    QRgb color = m_texture.pixel(u_tex, v_tex);
+    Color result(qRed(color)/255.0, qGreen(color)/255.0, qBlue(color)/255.0);
+    return result;
+}
+
+int GLBox::round(double dnumber)
+{
+    return (int) floor(dnumber+0.5);
+}
+
+//Koordinaten anpassen: z=point(1), x=point(0), y=-point(2)
+double GLBox::getPhi(Vec3d point)
+{
+    double phi = m_state.fastMath ? fastAtan2(-point(2),point(0)) : atan2(-point(2),point(0));
     return phi;
 }
 
 double GLBox::getTheta(Vec3d point)
 {
-    double temp_r = sqrt(point(0)*point(0)+point(1)*point(1)+point(2)*point(2));
-    double theta = acos(point(1)/temp_r);
+    double temp_r2 = point(0)*point(0)+point(1)*point(1)+point(2)*point(2);
+    if(m_state.fastMath)
+    {
+        return fastAcos(point(1)*fastRsqrt(temp_r2));
+    }
+    double theta = acos(point(1)/sqrt(temp_r2));
     return theta;
 }
 
 void GLBox::setPhiRot(int phi)
 {
     m_phiRot = (2*M_PI / 100) * phi - 2*M_PI / 100;
-    raycast();
-    updateGL();
+    postUpdate();
+}
+
+void GLBox::setFastMath(bool enabled)
+{
+    m_fastMath = enabled;
+    qDebug() << "Fast math" << (enabled ? "enabled" : "disabled");
+    postUpdate();
+}
+
+bool GLBox::getFastMath()
+{
+    return m_fastMath;
+}
+
+void GLBox::setTargetFrameTime(double ms)
+{
+    m_targetFrameTime = ms;
+    qDebug() << "Target frame time" << ms << "ms" << (ms > 0 ? "" : "(adaptive resolution disabled)");
+    postUpdate();
+}
+
+double GLBox::getTargetFrameTime()
+{
+    return m_targetFrameTime;
+}
+
+double GLBox::getRenderScale()
+{
+    return m_renderThread->getFrames().getFrontScale();
+}
+
+void GLBox::setProfiling(bool enabled)
+{
+    m_profiler.setEnabled(enabled);
+    if(enabled)
+    {
+        qDebug() << "Profiling overlay, bars from the bottom:";
+        for(int i=0; i<STAGE_COUNT; i++)
+        {
+            qDebug() << "  " << Profiler::getStageName(ProfileStage(i));
+        }
+        qDebug() << "   refined pixels (black, fraction of the width)";
+    }
+    else
+    {
+        qDebug() << "Profiling disabled";
+    }
+    postUpdate();
+}
+
+bool GLBox::getProfiling()
+{
+    return m_profiler.isEnabled();
+}
+
+bool GLBox::setProfileCsv(QString filename)
+{
+    if(!m_profiler.setCsvFile(filename))
+    {
+        qWarning("Cannot open %s", qPrintable(filename));
+        return false;
+    }
+    setProfiling(!filename.isEmpty());
+    return true;
+}
+
+bool GLBox::setTraceFile(QString filename)
+{
+    if(filename.isEmpty())
+    {
+        m_trace.close();
+        return true;
+    }
+    if(!m_trace.open(filename))
+    {
+        qWarning("Cannot open %s", qPrintable(filename));
+        return false;
+    }
+    return true;
+}
+
+void GLBox::drawProfileOverlay()
+{
+    //Stage colors, in the order of ProfileStage
+    static const unsigned char colors[STAGE_COUNT][3] = {
+        {230, 25, 75}, {60, 180, 75}, {255, 225, 25}, {0, 130, 200},
+        {245, 130, 48}, {210, 245, 60}, {145, 30, 180}, {240, 50, 230}, {70, 240, 240}, {128, 128, 128}
+    };
+
+    int maxLength = m_renderWidth - 2*PROFILE_BAR_MARGIN;
+    for(int i=0; i<STAGE_COUNT; i++)
+    {
+        int length = std::min(int(m_profiler.getStageTime(ProfileStage(i)) * PROFILE_BAR_PIXELS_PER_MS), maxLength);
+        int y0 = PROFILE_BAR_MARGIN + i*(PROFILE_BAR_HEIGHT + 1);
+        for(int y = y0; y < std::min(y0 + PROFILE_BAR_HEIGHT, m_renderHeight); y++)
+        {
+            unsigned char *pixel = &m_buffer[3*TO_LINEAR(PROFILE_BAR_MARGIN, y)];
+            for(int x = 0; x < length; x++, pixel += 3)
+            {
+                pixel[0] = colors[i][0];
+                pixel[1] = colors[i][1];
+                pixel[2] = colors[i][2];
+            }
+        }
+    }
+
+    //Last bar: fraction of the pixels refined by anti-aliasing, full length if all are
+    int length = int(m_profiler.getStats().getRefinedFraction() * maxLength);
+    int y0 = PROFILE_BAR_MARGIN + STAGE_COUNT*(PROFILE_BAR_HEIGHT + 1);
+    for(int y = y0; y < std::min(y0 + PROFILE_BAR_HEIGHT, m_renderHeight); y++)
+    {
+        memset(&m_buffer[3*TO_LINEAR(PROFILE_BAR_MARGIN, y)], 0, 3*length);
+    }
+}
+
+void GLBox::setPreview(bool enabled)
+{
+    m_preview = enabled;
+    qDebug() << (enabled ? "Rasterized preview" : "Ray casting");
+    postUpdate();
+}
+
+bool GLBox::getPreview()
+{
+    return m_preview;
+}
+
+void GLBox::setOverlays(bool enabled)
+{
+    m_overlays = enabled;
+    postUpdate();
+}
+
+bool GLBox::getOverlays()
+{
+    return m_overlays;
+}
+
+void GLBox::setAntialiasing(bool enabled)
+{
+    m_antialiasing = enabled;
+    qDebug() << (enabled ? "Adaptive anti-aliasing" : "Anti-aliasing disabled");
+    postUpdate();
+}
+
+bool GLBox::getAntialiasing()
+{
+    return m_antialiasing;
+}
+
+void GLBox::compareFastMath()
+{
+    m_stateMutex.lock();
+    m_compareRequested = true;
+    m_stateMutex.unlock();
+    postUpdate();
+}
+
+bool GLBox::checkFastMathImage()
+{
+    //The frames are rendered here, so the render thread must not start any
+    m_renderThread->stop();
+
+    m_stateMutex.lock();
+    postState();
+    m_compareRequested = true;
+    m_stateMutex.unlock();
+
+    std::vector<unsigned char> frame(3*TEX_RES);
+    double renderScale;
+    renderFrame(&frame[0], renderScale);
+    return m_comparePassed;
+}
+
+bool GLBox::runFastMathComparison()
+{
+    bool fastMath = m_state.fastMath;
+
+    //Reference image with libm
+    m_state.fastMath = false;
+    bool completed = raycast();
+    std::vector<unsigned char> reference(m_buffer, m_buffer + 3*TEX_RES);
+
+    m_state.fastMath = true;
+    completed = completed && raycast();
+    m_state.fastMath = fastMath;
+
+    //The comparison is no part of the frame, its ray casts must not show up in the stage times
+    m_profiler.discardFrame();
+    if(!completed)
+    {
+        qDebug() << "Fast math vs. libm: comparison cancelled by new input";
+        return false;
+    }
+
+    int maxDiff = 0;
+    long sumDiff = 0;
+    int outliers = 0;
+    for(int i=0; i<3*TEX_RES; i++)
+    {
+        int diff = abs(int(m_buffer[i]) - int(reference[i]));
+        sumDiff += diff;
+        if(diff > maxDiff) maxDiff = diff;
+        if(diff > 1) outliers++;
+    }
+    double meanDiff = sumDiff / double(3*TEX_RES);
+    double outlierRatio = outliers / double(3*TEX_RES);
+    bool passed = meanDiff <= FAST_MATH_MAX_MEAN_DIFF && outlierRatio <= FAST_MATH_MAX_OUTLIERS;
+
+    qDebug() << "Fast math vs. libm: mean difference" << meanDiff << "max difference" << maxDiff
+             << "outliers" << outlierRatio << (passed ? "passed" : "FAILED");
+
+    return passed;
 }
@@ -25,6 +25,21 @@
 #include "camera.h"
 #include "sphere.h"
 #include "light.h"
+#include "scenegraph.h"
+#include "sceneloader.h"
+#include "renderthread.h"
+#include "resolutioncontroller.h"
+#include "profiler.h"
+#include "tracewriter.h"
+#include "tileworker.h"
+#include "rasterizer.h"
+#include "bresenham.h"
+#include "overlay.h"
+#include "linemesh.h"
+#include "trianglemesh.h"
+#include "spherebvh.h"
+#include <QThreadPool>
+#include <QMutex>
 #include <QImage>
 
 // Texture resolution
@@ -38,9 +53,77 @@
 #define TEX_HALF_X TEX_RES_X/2
 #define TEX_HALF_Y TEX_RES_Y/2
 
+// Accepted image difference of the fast math approximations against libm (see compareFastMath()).
+// Larger differences only occur where a texel boundary is crossed.
+#define FAST_MATH_MAX_MEAN_DIFF 0.05
+#define FAST_MATH_MAX_OUTLIERS 0.001
+
+// Edge length of the screen tiles used for ray casting and light culling
+#define TILE_SIZE 16
+
+// Adaptive anti-aliasing: pixels whose object, shadowed lights or luminance (0-255) differ
+// from a neighbour by more than AA_CONTRAST get one extra sample in each of AA_STRATA^2 strata
+#define AA_STRATA 2
+#define AA_CONTRAST 32
+
+// Reflection and refraction: secondary rays per pixel and frame, split evenly among the tiles,
+// and the maximum number of bounces. Surfaces beyond either limit are only shaded locally.
+#define SECONDARY_RAY_BUDGET 2.0
+#define SECONDARY_MAX_DEPTH 5
+
+// Rays whose weight drops below SECONDARY_ROULETTE_WEIGHT survive with probability
+// weight / SECONDARY_ROULETTE_WEIGHT and carry the weight of the terminated ones
+#define SECONDARY_ROULETTE_WEIGHT 0.1
+
+// Minimum distance of secondary hits from the ray origin
+#define SECONDARY_EPSILON 1e-4
+
+// Profiling overlay: one bar per stage, PROFILE_BAR_PIXELS_PER_MS pixels long per millisecond
+#define PROFILE_BAR_PIXELS_PER_MS 8
+#define PROFILE_BAR_HEIGHT 4
+#define PROFILE_BAR_MARGIN 4
+
+// Tessellation of spheres in the preview: edge length in pixels of the projected segments
+// and limits of the number of segments around the sphere
+#define RASTER_SEGMENT_LENGTH 8.0
+#define RASTER_MIN_SEGMENTS 8
+#define RASTER_MAX_SEGMENTS 128
+
+// Interval in milliseconds in which the accumulated input is handed to the render thread,
+// about one display frame
+#define INPUT_FRAME_INTERVAL 16
+
+// Consecutive frames newer input may cancel, the frame after them is always finished.
+// Without the limit, continuous input with frames slower than INPUT_FRAME_INTERVAL would
+// never present a frame.
+#define MAX_CANCELLED_FRAMES 1
+
 // Converts x,y coordinates to the position in a linear array.
 #define TO_LINEAR(x, y) (((x)) + TEX_RES_X*((y)))
 
+// Reflected or refracted ray waiting to be traced (see GLBox::traceSecondary())
+struct SecondaryRay
+{
+    Vec3d origin;
+    Vec3d dir;
+    Vec3d weight;       // Share of the ray in the pixel color
+    Vec3d fallback;     // Local color of the surface the ray leaves, used if it is not traced
+    int depth;          // Bounces up to its origin, 1 for rays leaving the primary hit
+};
+
+// Input of the GUI the render thread takes over at the start of each frame
+struct RenderState
+{
+    Camera cam;
+    double focus;
+    int phiRot;
+    bool fastMath;
+    double targetFrameTime;
+    bool preview;
+    bool overlays;
+    bool antialiasing;
+};
+
 class GLBox : public QGLWidget
 {
     Q_OBJECT
@@ -67,10 +150,73 @@ public:
     // Change phi rotation
     void setPhiRot(int phi);
 
+    // Replace the scene by the content of a scene file (see sceneloader.h)
+    bool loadScene(QString filename);
+
+    // Render one frame with the latest posted input into target. Called by the render thread.
+    // Returns false without touching target if nothing affecting the image changed since the
+    // last frame, otherwise sets scale to the render scale of the frame.
+    bool renderFrame(unsigned char *target, double &scale);
+
+    // Switch between the libm functions and the approximations of fastmath.h for shading
+    void setFastMath(bool enabled);
+
+    bool getFastMath();
+
+    // Target frame time in milliseconds for the adaptive render resolution, <= 0 disables it
+    void setTargetFrameTime(double ms);
+
+    double getTargetFrameTime();
+
+    // Render scale of the displayed frame
+    double getRenderScale();
+
+    // Time the stages of each frame and show them as overlay (see profiler.h)
+    void setProfiling(bool enabled);
+
+    bool getProfiling();
+
+    // Stream the stage times to a CSV file and enable profiling, an empty filename stops it
+    bool setProfileCsv(QString filename);
+
+    // Write per-thread frame, tile and paint events with ray counters as Chrome trace JSON,
+    // an empty filename finishes the trace
+    bool setTraceFile(QString filename);
+
+    // Ray cast tiles of the current frame until all are taken or the frame is superseded.
+    // In the anti-aliasing pass the edges of the tiles are refined instead. Called by the tile workers.
+    void raycastTiles(TileWorker &worker);
+
+    // Switch between ray casting and the rasterized preview
+    void setPreview(bool enabled);
+
+    bool getPreview();
+
+    // Show the clock and the cuboids as anti-aliased overlay
+    void setOverlays(bool enabled);
+
+    bool getOverlays();
+
+    // Add samples to the pixels at edges of objects, shadows and strong contrast
+    void setAntialiasing(bool enabled);
+
+    bool getAntialiasing();
+
+    // Let the render thread compare fast math and libm with the next frame (see runFastMathComparison())
+    void compareFastMath();
+
+    // Render the scene with and without fast math on the calling thread and compare the images,
+    // see runFastMathComparison(). Stops the render thread for good, for checks without a window.
+    bool checkFastMathImage();
+
 public slots:
     // Perform all computations necessary to animate the scene. Invoked by the timer.
     void animate();
 
+protected slots:
+    // Hand the input accumulated since the last call to the render thread. Invoked by m_inputTimer.
+    void flushInput();
+
 protected:
     // Initialize the OpenGL setting.
     void initializeGL();
@@ -92,8 +238,18 @@ protected:
     // Note that the coordinate range for the point is [-TEX_HALF, TEXHALF].
     void setPoint(Point2D p, Color c = Color(0.0, 0.0, 0.0));
 
+    // The rendered part of the image buffer as target for the line and circle drawing functions
+    PixelBuffer getPixelBuffer();
+
     // methods to deal with events from the mouse and the mouse wheel
 
+    // Schedule a new frame with the current input. Call after every change of the input that
+    // affects the image; all changes within one INPUT_FRAME_INTERVAL result in one frame.
+    void postUpdate();
+
+    // Copy the input members of the GUI to m_posted. Call with m_stateMutex locked.
+    void postState();
+
     // Invoked when the mouse is moved.
     void mouseMoveEvent (QMouseEvent *);
 
@@ -112,26 +268,128 @@ protected:
     //Initialize cuboids
     void initializeCuboids();
 
-    // Draw a cuboid
-    void makeCuboid(Vec4d cub[8]);
+    // Draw the clock and the cuboids into m_overlay and blend it over the frame.
+    // Without anti-aliasing they are drawn with aliased lines straight into the frame.
+    void drawOverlays();
+
+    // Add the edges of a wireframe mesh to m_overlay, scale is the render scale of the frame.
+    // Aliased edges are drawn straight into the frame.
+    void overlayLineMesh(LineMesh &mesh, double scale, const unsigned char color[3], bool aliased);
+
+    // Add a scene graph node for the sphere. If parentSph is a sphere, the sphere
+    // orbits it around orbitAxis by speed radians per animation step. The axis is in the frame
+    // of the parent and turns with it (see SceneGraph::setOrbit()).
+    int addSphereNode(int sph, int parentSph, Vec4d orbitAxis = Vec4d(), double speed = 0);
+
+    // Update the scene graph and move the spheres of all changed nodes
+    void updateScene();
+
+    // Refit the sphere hierarchy to the moved spheres, take over a finished
+    // background rebuild and start a new one once the tree is too degraded
+    void updateSphereBvh();
+
+    // Replace the scene rendered by the render thread
+    void installScene(Scene &scene);
+
+    // Render the scene with and without fast math and report the image difference.
+    // Returns true if the mean difference is at most FAST_MATH_MAX_MEAN_DIFF levels per channel
+    // and at most FAST_MATH_MAX_OUTLIERS of the channels differ by more than one level.
+    bool runFastMathComparison();
+
+    // Ray casting on the tile workers. Returns false if newer input superseded the frame before
+    // all tiles were cast. Anti-aliasing is skipped or stopped early instead, the frame is shown.
+    bool raycast();
+
+    // Build the candidate spheres of every tile from the projected bounds of the spheres.
+    // Spheres reaching the plane of the eye are candidates of all tiles.
+    void binSpheres();
+
+    // Rasterized preview of the spheres and cuboids with depth buffer, seen like the ray cast frame
+    bool rasterize();
+
+    // Draw a sphere as triangles, tessellated according to its projected radius
+    void rasterizeSphere(sphere &sph);
+
+    // Draw a cuboid as flat shaded triangles. Corners 0-3 and 4-7 are opposite faces, like in LineMesh::addBox().
+    void rasterizeCuboid(const Vec4d *cub);
+
+    // Vertex color of the preview: ambient and diffuse lighting of all lights, without shadows
+    Vec3d previewColor(Vec3d pos, Vec3d normal, Material mat);
+
+    // Repeat the last rendered column and row of a reduced resolution frame
+    void extendBorder();
+
+    // Newer input was flushed since the current frame started and the frame may be cancelled
+    bool isSuperseded();
 
-    // Projection
-    Vec4d projectZ(Vec4d &vec, double focus);
+    // Duration in milliseconds a cancelled frame would have taken, extrapolated from the
+    // time it ran and the tiles it took
+    double estimateFrameTime(double elapsed);
 
-    // Draw sphere
-    void makeSphere(sphere sph);
+    // Ray casting of the pixels in the tile starting at (x0, y0)
+    void raycastTile(int x0, int y0, Vec3d eye, TileWorker &worker);
 
-    // Ray casting
-    void raycast();
+    // Anti-aliasing of the edge pixels in the tile starting at (x0, y0), after all tiles are cast
+    void antialiasTile(int x0, int y0, Vec3d eye, TileWorker &worker);
 
-    // Sort hit points
-    void sortHits(std::vector<Vec3d> &hits, std::vector<int> &indices);
+    // Does the pixel differ from a neighbour in object, shadowed lights or luminance?
+    bool isEdgePixel(int x, int y);
 
-    // Phong shading
+    // Color of a single ray, with the spheres m_tileSpheres[candidateStart, candidateEnd).
+    // budget and seed as in traceSecondary().
+    Color traceSample(Vec3d eye, Vec3d dir, int candidateStart, int candidateEnd,
+                      int &budget, int seed, TileWorker &worker, RayStats &stats);
+
+    // Local color of a hit: texture, lights culled at the hit and shadow rays.
+    // The lights and shadow flags are kept in the scratch space of the worker.
+    Color shadeHit(int object, int triangle, Vec3d hit, Vec3d eye, TileWorker &worker, RayStats &stats);
+
+    // Color of a hit seen along dir, with local color "local", including its reflection and
+    // refraction. The secondary rays are traced with an explicit stack and taken from budget.
+    // seed makes the Russian roulette of a pixel the same in every frame.
+    Color traceSecondary(int object, int triangle, Vec3d hit, Vec3d dir, Color local,
+                         int &budget, int seed, TileWorker &worker, RayStats &stats);
+
+    // Add the local share of a hit to color and push its reflected and refracted rays
+    void pushSecondaryRays(int object, int triangle, Vec3d hit, Vec3d dir, Vec3d local, Vec3d weight, int depth,
+                           SecondaryRay *stack, int &stackSize, Vec3d &color);
+
+    // Closest hit with t > SECONDARY_EPSILON of the spheres and mesh instances, for rays in any direction.
+    // Returns false if there is none.
+    bool intersectNearest(Vec3d origin, Vec3d dir, Vec3d &hit, int &object, int &triangle, RayStats &stats);
+
+    // Secondary rays of a tile with the given number of pixels
+    int getSecondaryBudget(int pixels);
+
+    // Add the counters of a finished tile to the frame and trace the tile
+    void recordTile(int x0, int y0, qint64 traceStart, const RayStats &stats, TileWorker &worker);
+
+    // Collect the lights whose influence radius reaches the given bounding box
+    void cullLights(Vec3d boundsMin, Vec3d boundsMax, std::vector<int> &lights);
+
+    // Texture color at the hit point
+    Vec3d getTextureColor(Vec3d hit);
+
+    // Color of the hit point on the object, lit by the given lights.
+    // shadowed holds one flag per light.
+    Color shade(int object, int triangle, Vec3d hit, Vec3d eye, Vec3d texColor, const std::vector<int> &lights, const char *shadowed);
+
+    // Closest hit of the ray with the mesh instances if it has a larger z than "hit".
+    // Objects are numbered with the spheres first, then the instances.
+    void intersectInstances(Vec3d origin, Vec3d dir, Vec3d &hit, int &object, int &triangle, RayStats &stats);
+
+    // Material and unit normal of a sphere or mesh instance at the hit point
+    Material getObjectMaterial(int object);
+    Vec3d getObjectNormal(int object, int triangle, Vec3d hit);
+
+    // Draw the stage times of the last frame as bars into the buffer
+    void drawProfileOverlay();
+
+    // Phong shading of one light: diffuse, specular towards the eye position and ambient
     Color phong(Vec3d hit, Vec3d eyePos, Vec3d normal, Light light, Material Material);
 
-    // Shadow sensor
-    bool isShadowed(sphere *sphere, Vec3d hit, Light light);
+    // Shadow sensor, the object itself only casts shadows if it is a mesh
+    bool isShadowed(int object, Vec3d hit, Light light, RayStats &stats);
 
     // Load texture
     void loadTexture(QString filename);
@@ -155,7 +413,7 @@ private:
     // value of the last mouse cursor position, needed for rotating, translating, etc.
     double x0, y0;
 
-    unsigned char *m_buffer; // Global texture memory.
+    unsigned char *m_buffer; // Render target of the current frame, owned by the render thread.
     int m_winWidth; // Window width
     int m_winHeight; // Window height
     GLuint m_texID; // Texture ID for OpenGL
@@ -167,9 +425,7 @@ private:
 
     double m_focus; //focus
 
-    Vec4d m_cub1[8];
-    Vec4d m_cub2[8];
-    Vec4d m_cub3[8];
+    LineMesh m_cuboids; // The three cuboids as one wireframe mesh, rasterized by the preview
 
     Mat4d cubTransMat;
     Vec4d transVec;
@@ -177,9 +433,6 @@ private:
     Vec4d rotAxis;
     double angle1;
 
-    Vec3d cub2[8];
-    Vec4d projectedVec;
-
     Camera m_cam;
 
     int m_sphereCount;
@@ -190,8 +443,6 @@ private:
     sphere m_sphere5;
     sphere m_sphere6;
 
-    Mat4d sphereTransMat;
-
     double angle2;
 
     Vec4d sphereRotAxis;
@@ -203,14 +454,97 @@ private:
 
     Vec4d tempVec;
 
-    std::vector<sphere*> m_spheres;
-    std::vector<Mat4d> m_matrices;
+    std::vector<sphere> m_spheres;
+
+    SceneGraph m_sceneGraph;
+    std::vector<int> m_sphereNodes; // Scene graph node of each sphere
+    std::vector<int> m_nodeSpheres; // Sphere of each scene graph node, -1 if none
+    std::vector<int> m_movedSpheres;    // Spheres moved by the last updateScene()
 
-    Light m_light;
+    // Sphere hierarchy for shadow rays, render thread only. It is rebuilt on m_bvhPool.
+    SphereBvh m_sphereBvh;
+    SphereBvhBuilder m_bvhBuilder;
+    QThreadPool m_bvhPool;
+
+    std::vector<Light> m_lights;
 
     QImage m_texture;
 
     int m_phiRot;
+
+    bool m_fastMath; // Use the approximations of fastmath.h
+
+    bool m_preview; // Rasterize instead of ray casting
+
+    bool m_overlays; // Draw clock and cuboids over the frame
+
+    bool m_antialiasing; // Adaptive anti-aliasing of the ray cast frame
+
+    // Rendering runs on m_renderThread. Only the GUI uses m_cam, m_focus, m_phiRot, m_fastMath
+    // and m_targetFrameTime; input events accumulate in them and flushInput() copies them to
+    // m_posted. m_posted and the pending members are only used while holding m_stateMutex.
+    // The render thread copies m_posted into m_state at the start of each frame and owns
+    // the scene (spheres, lights, scene graph, texture).
+    RenderThread *m_renderThread;
+    QTimer *m_inputTimer;           // Single shot, runs while input waits for flushInput()
+    QMutex m_stateMutex;
+    RenderState m_posted;           // Input of the next frame
+    RenderState m_state;            // Input of the frame being rendered
+    int m_pendingSteps;             // Animation steps not yet applied to the scene
+    QAtomicInt m_inputVersion;      // Incremented by flushInput(), read by the tile workers
+    int m_renderedVersion;          // Input version of the current frame, set by the render thread
+    int m_cancelledFrames;          // Frames cancelled since the last finished one, render thread
+    bool m_frameReduced;            // Last frame was rendered at reduced resolution or without shadows
+    bool m_compareRequested;        // Run the fast math comparison with the next frame
+    bool m_comparePassed;           // Result of the last fast math comparison
+    Scene m_pendingScene;           // Scene loaded by the GUI, not yet installed
+    bool m_scenePending;
+    double m_targetFrameTime;       // Target frame time of the adaptive resolution
+
+    // Adaptive resolution, owned by the render thread. Frames are rendered into the top left
+    // m_renderWidth x m_renderHeight pixels of the buffer and scaled up by paintGL().
+    ResolutionController m_resolution;
+    int m_renderWidth;
+    int m_renderHeight;
+    bool m_renderShadows;
+
+    Profiler m_profiler;    // Used by the render and the GUI thread
+    TraceWriter m_trace;    // Used by the render and the GUI thread
+    RayStats m_frameStats;  // Counters of the frame being rendered
+
+    // Tile workers, started by raycast() for every frame
+    QThreadPool m_tilePool;
+    std::vector<TileWorker*> m_tileWorkers;
+    QAtomicInt m_nextTile;  // Next tile to be taken by a worker
+    int m_tileCount;        // Tiles of the current frame
+    int m_tilesX;           // Tiles per row
+    std::vector<int> m_tileSphereStart; // Per tile: first entry in m_tileSpheres, one more for the end
+    std::vector<int> m_tileSpheres;     // Candidate spheres of the tiles in ascending order
+    std::vector<int> m_sphereTiles;     // Per sphere: covered tile rectangle x0, y0, x1, y1 (inclusive)
+    bool m_antialiasPass;   // The workers refine edges instead of casting tiles
+
+    // Per pixel of the cast frame, at TO_LINEAR(x, y): the edge detection input of the anti-aliasing pass
+    std::vector<int> m_pixelObjects;            // Hit object, -1 if none
+    std::vector<unsigned char> m_pixelShadows;  // Bit (light & 7) set if the light is shadowed
+    std::vector<unsigned char> m_pixelLuma;     // Luminance before anti-aliasing
+
+    // Preview, render thread only
+    Rasterizer m_rasterizer;
+    std::vector<RasterVertex> m_rasterVertices;
+    Mat4d m_previewProjMat;         // Projection of the ray caster for the current frame
+
+    // Anti-aliased overlay, render thread only
+    CoverageOverlay m_overlay;
+
+    // Triangle meshes of the scene and their placements, owned by the render thread
+    std::vector<TriangleMesh> m_models;
+    std::vector<MeshInstance> m_instances;
+
+    // Wireframe meshes of the scene, owned by the render thread
+    std::vector<LineMesh> m_meshes;
+    std::vector<Vec3d> m_meshColors;
+    std::vector<Vec4d> m_meshClip;      // Transformed vertices of the mesh being drawn
+    std::vector<double> m_meshSegments; // Screen coordinates of its visible edges
 };
 
 #endif // _GLBOX_H_
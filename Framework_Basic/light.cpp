@@ -2,14 +2,15 @@
 
 Light::Light()
 {
-
+    m_radius = INFINITY;
 }
 
-Light::Light(Vec3d position, Vec3d lightColor, Vec3d ambientColor)
+Light::Light(Vec3d position, Vec3d lightColor, Vec3d ambientColor, double radius)
 {
     m_position = position;
     m_lightColor = lightColor;
     m_ambientColor = ambientColor;
+    m_radius = radius;
 }
 
 Vec3d Light::getPosition()
@@ -26,3 +27,25 @@ Vec3d Light::getAmbient()
 {
     return m_ambientColor;
 }
+
+double Light::getRadius()
+{
+    return m_radius;
+}
+
+double Light::getAttenuation(double distance)
+{
+    if(m_radius == INFINITY)
+    {
+        return 1;
+    }
+    if(distance >= m_radius)
+    {
+        return 0;
+    }
+
+    //Smooth window, falls to 0 at the radius
+    double ratio = distance / m_radius;
+    double window = 1 - ratio*ratio;
+    return window*window;
+}
@@ -8,7 +8,8 @@ class Light
 public:
     Light();
 
-    Light(Vec3d position, Vec3d lightColor, Vec3d ambientColor);
+    // radius: distance beyond which the light has no influence, INFINITY for unbounded lights
+    Light(Vec3d position, Vec3d lightColor, Vec3d ambientColor, double radius = INFINITY);
 
     Vec3d getPosition();
 
@@ -16,10 +17,16 @@ public:
 
     Vec3d getAmbient();
 
+    double getRadius();
+
+    // Falloff at the given distance, 1 for unbounded lights and 0 beyond the radius
+    double getAttenuation(double distance);
+
 private:
     Vec3d m_position;
     Vec3d m_lightColor;
     Vec3d m_ambientColor;
+    double m_radius;
 };
 
 #endif // LIGHT_H
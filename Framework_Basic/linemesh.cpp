@@ -0,0 +1,295 @@
+#include "linemesh.h"
+#include "transform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <utility>
+#include <QFile>
+
+// Maximum length of a line in an OBJ file
+#define MAX_OBJ_LINE 4096
+
+LineMesh::LineMesh()
+{
+    clear();
+}
+
+void LineMesh::clear()
+{
+    m_vertices.clear();
+    m_edges.clear();
+    m_boundsMin = Vec3d(INFINITY, INFINITY, INFINITY);
+    m_boundsMax = Vec3d(-INFINITY, -INFINITY, -INFINITY);
+}
+
+QString LineMesh::getError()
+{
+    return m_error;
+}
+
+int LineMesh::addVertex(Vec4d v)
+{
+    m_vertices.push_back(v);
+    updateBounds(v);
+    return m_vertices.size() - 1;
+}
+
+void LineMesh::addEdge(int v1, int v2)
+{
+    m_edges.push_back(v1);
+    m_edges.push_back(v2);
+}
+
+void LineMesh::addBox(Vec4d c1, Vec4d c2)
+{
+    int first = m_vertices.size();
+    for(int i=0; i<8; i++)
+    {
+        //x changes from corner 0 to 1, y from 1 to 2, z from the first to the second face
+        bool x = i == 1 || i == 2 || i == 5 || i == 6;
+        bool y = (i & 3) >= 2;
+        bool z = i >= 4;
+        addVertex(Vec4d(x ? c2(0) : c1(0), y ? c2(1) : c1(1), z ? c2(2) : c1(2), 1));
+    }
+
+    static const int edges[24] = {0,1, 0,3, 0,4, 1,2, 1,5, 2,3, 2,6, 3,7, 4,5, 4,7, 5,6, 6,7};
+    for(int i=0; i<12; i++)
+    {
+        addEdge(first + edges[2*i], first + edges[2*i+1]);
+    }
+}
+
+const std::vector<Vec4d> &LineMesh::getVertices()
+{
+    return m_vertices;
+}
+
+const std::vector<int> &LineMesh::getEdges()
+{
+    return m_edges;
+}
+
+int LineMesh::getEdgeCount()
+{
+    return m_edges.size() / 2;
+}
+
+size_t LineMesh::memoryUsage()
+{
+    return m_vertices.capacity()*sizeof(Vec4d) + m_edges.capacity()*sizeof(int);
+}
+
+Vec3d LineMesh::getBoundsMin()
+{
+    return m_boundsMin;
+}
+
+Vec3d LineMesh::getBoundsMax()
+{
+    return m_boundsMax;
+}
+
+void LineMesh::updateBounds(Vec4d v)
+{
+    for(int i=0; i<3; i++)
+    {
+        m_boundsMin(i) = std::min(m_boundsMin(i), v(i));
+        m_boundsMax(i) = std::max(m_boundsMax(i), v(i));
+    }
+}
+
+int LineMesh::objIndex(int index)
+{
+    int count = m_vertices.size();
+    if(index > 0 && index <= count)
+    {
+        return index - 1;
+    }
+    if(index < 0 && -index <= count)
+    {
+        return count + index;
+    }
+    return -1;
+}
+
+bool LineMesh::loadObj(QString filename)
+{
+    clear();
+    m_error = QString();
+
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        m_error = "Cannot open " + filename + ": " + file.errorString();
+        return false;
+    }
+
+    char line[MAX_OBJ_LINE];
+    int lineNumber = 0;
+    while(file.readLine(line, MAX_OBJ_LINE) > 0)
+    {
+        lineNumber++;
+        const char *p = line;
+        while(*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+
+        if(p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            double x, y, z;
+            if(sscanf(p + 1, "%lf %lf %lf", &x, &y, &z) != 3)
+            {
+                m_error = QString("%1: line %2: invalid vertex").arg(filename).arg(lineNumber);
+                clear();
+                return false;
+            }
+            addVertex(Vec4d(x, y, z, 1));
+        }
+        else if((p[0] == 'l' || p[0] == 'f') && (p[1] == ' ' || p[1] == '\t'))
+        {
+            //Vertex references, texture and normal indices after '/' are skipped
+            bool face = p[0] == 'f';
+            char *s = const_cast<char*>(p + 1);
+            int first = -1;
+            int previous = -1;
+            forever
+            {
+                char *end;
+                int index = int(strtol(s, &end, 10));
+                if(end == s)
+                {
+                    break;
+                }
+                int v = objIndex(index);
+                if(v < 0)
+                {
+                    m_error = QString("%1: line %2: invalid vertex index %3").arg(filename).arg(lineNumber).arg(index);
+                    clear();
+                    return false;
+                }
+                if(previous >= 0)
+                {
+                    addEdge(previous, v);
+                }
+                else
+                {
+                    first = v;
+                }
+                previous = v;
+
+                s = end;
+                while(*s != '\0' && *s != ' ' && *s != '\t' && *s != '\n' && *s != '\r')
+                {
+                    s++;
+                }
+            }
+            if(face && first >= 0 && previous != first)
+            {
+                addEdge(previous, first);
+            }
+        }
+    }
+
+    removeDuplicateEdges();
+    return true;
+}
+
+void LineMesh::removeDuplicateEdges()
+{
+    int count = getEdgeCount();
+    std::vector<std::pair<int, int> > edges(count);
+    for(int i=0; i<count; i++)
+    {
+        edges[i] = std::make_pair(std::min(m_edges[2*i], m_edges[2*i+1]), std::max(m_edges[2*i], m_edges[2*i+1]));
+    }
+    std::sort(edges.begin(), edges.end());
+    count = std::unique(edges.begin(), edges.end()) - edges.begin();
+
+    m_edges.resize(2*count);
+    for(int i=0; i<count; i++)
+    {
+        m_edges[2*i] = edges[i].first;
+        m_edges[2*i+1] = edges[i].second;
+    }
+}
+
+int LineMesh::project(const Mat4d &mat, double scaleX, double scaleY, double offsetX, double offsetY,
+                      std::vector<Vec4d> &clip, std::vector<double> &segments)
+{
+    if(m_edges.empty())
+    {
+        return 0;
+    }
+
+    //Cull the mesh if all corners of its bounding box lie outside of the same frustum plane
+    Vec4d corners[8];
+    for(int i=0; i<8; i++)
+    {
+        corners[i] = Vec4d(i & 1 ? m_boundsMax(0) : m_boundsMin(0),
+                           i & 2 ? m_boundsMax(1) : m_boundsMin(1),
+                           i & 4 ? m_boundsMax(2) : m_boundsMin(2), 1);
+    }
+    transformPoints(mat, corners, corners, 8);
+    int outside[5] = {0, 0, 0, 0, 0};
+    for(int i=0; i<8; i++)
+    {
+        double w = corners[i](3);
+        outside[0] += corners[i](0) > w;
+        outside[1] += corners[i](0) < -w;
+        outside[2] += corners[i](1) > w;
+        outside[3] += corners[i](1) < -w;
+        outside[4] += w < MESH_NEAR_W;
+    }
+    for(int i=0; i<5; i++)
+    {
+        if(outside[i] == 8)
+        {
+            return 0;
+        }
+    }
+
+    //Every vertex is transformed once, edges only look up their end points
+    int vertexCount = m_vertices.size();
+    clip.resize(vertexCount);
+    transformPoints(mat, &m_vertices[0], &clip[0], vertexCount);
+
+    int edgeCount = getEdgeCount();
+    size_t start = segments.size();
+    segments.resize(start + 4*edgeCount);
+    double *out = &segments[start];
+    const int *edge = &m_edges[0];
+    for(int i=0; i<edgeCount; i++, edge += 2)
+    {
+        Vec4d a = clip[edge[0]];
+        Vec4d b = clip[edge[1]];
+        double wa = a(3);
+        double wb = b(3);
+        if(wa < MESH_NEAR_W && wb < MESH_NEAR_W)
+        {
+            continue;
+        }
+
+        //Move the end point behind the camera onto the near plane
+        if(wa < MESH_NEAR_W)
+        {
+            a = a + (b - a)*((MESH_NEAR_W - wa) / (wb - wa));
+        }
+        else if(wb < MESH_NEAR_W)
+        {
+            b = b + (a - b)*((MESH_NEAR_W - wb) / (wa - wb));
+        }
+
+        out[0] = a(0) / a(3) * scaleX + offsetX;
+        out[1] = a(1) / a(3) * scaleY + offsetY;
+        out[2] = b(0) / b(3) * scaleX + offsetX;
+        out[3] = b(1) / b(3) * scaleY + offsetY;
+        out += 4;
+    }
+
+    int added = (out - &segments[start]) / 4;
+    segments.resize(start + 4*added);
+    return added;
+}
@@ -0,0 +1,81 @@
+//
+// LineMesh
+//
+// Indexed wireframe mesh: a vertex buffer and an edge index buffer with two vertex
+// indices per edge. project() transforms every vertex exactly once, culls the whole mesh
+// by its bounding box against the view frustum and clips edges against the near plane,
+// so the result can go straight to the batched line drawing of bresenham.h and overlay.h.
+//
+// OBJ files are read with their "v", "l" and "f" entries. Polylines are split into their
+// segments, faces into their outline edges; edges shared by faces are stored once.
+//
+
+#ifndef LINEMESH_H
+#define LINEMESH_H
+
+#include <vector>
+#include <QString>
+#include "vector.h"
+#include "matrix.h"
+
+// Points with a smaller homogeneous w lie behind the near plane of the camera
+#define MESH_NEAR_W 1e-3
+
+class LineMesh
+{
+public:
+    LineMesh();
+
+    void clear();
+
+    // Load an OBJ file, returns false on error, see getError()
+    bool loadObj(QString filename);
+
+    QString getError();
+
+    // Add a vertex, returns its index
+    int addVertex(Vec4d v);
+
+    void addEdge(int v1, int v2);
+
+    // Add the twelve edges of the axis aligned box with the opposite corners c1 and c2.
+    // Corners 0-3 run around the face at c1(2), corners 4-7 around the face at c2(2).
+    void addBox(Vec4d c1, Vec4d c2);
+
+    const std::vector<Vec4d> &getVertices();
+
+    const std::vector<int> &getEdges();
+
+    int getEdgeCount();
+
+    // Heap memory of the vertex and edge arrays in bytes
+    size_t memoryUsage();
+
+    // Bounding box of all vertices
+    Vec3d getBoundsMin();
+    Vec3d getBoundsMax();
+
+    // Transform the mesh by the projection matrix "mat" and append the visible edges to
+    // "segments", four screen coordinates per edge: x/w * scaleX + offsetX, y/w * scaleY + offsetY.
+    // "clip" is scratch space for the transformed vertices. Returns the number of edges added,
+    // 0 if the bounding box lies outside of -w <= x, y <= w, w >= MESH_NEAR_W.
+    int project(const Mat4d &mat, double scaleX, double scaleY, double offsetX, double offsetY,
+                std::vector<Vec4d> &clip, std::vector<double> &segments);
+
+private:
+    // Resolve a 1-based or negative (relative) OBJ index, -1 if invalid
+    int objIndex(int index);
+
+    // Remove duplicate edges, (a, b) and (b, a) count as the same edge
+    void removeDuplicateEdges();
+
+    void updateBounds(Vec4d v);
+
+    std::vector<Vec4d> m_vertices;
+    std::vector<int> m_edges;   // Two vertex indices per edge
+    Vec3d m_boundsMin;
+    Vec3d m_boundsMax;
+    QString m_error;
+};
+
+#endif // LINEMESH_H
@@ -7,12 +7,46 @@
 
 #include <qapplication.h>
 #include "MainWindow.h"
+#include "glbox.h"
+#include "sceneloader.h"
+#include "fastmath.h"
+#include "rasterizer.h"
 
 int main( int argc, char** argv )
 {
     // always the first thing to do in a Qt application: create a QApplication object
     QApplication app( argc, argv );
 
+    // "BasicViewer --convert scene.scn scene.scb" converts a text scene file to the binary format
+    if ( argc == 4 && QString(argv[1]) == "--convert" )
+    {
+        SceneLoader loader;
+        Scene scene;
+        if ( !loader.load(argv[2], scene) || !loader.saveBinary(argv[3], scene) )
+        {
+            qWarning( "%s", qPrintable(loader.getError()) );
+            return -1;
+        }
+        return 0;
+    }
+
+    // "BasicViewer --check-fastmath [scene.scn]" compares the approximations of fastmath.h with libm,
+    // then renders the scene (the built-in one without argument) with both and compares the images.
+    // Only textured scenes like scenes/solar.scn cover the texture lookups.
+    if ( (argc == 2 || argc == 3) && QString(argv[1]) == "--check-fastmath" )
+    {
+        bool passed = checkFastMath();
+        GLBox box(0);
+        if ( argc == 3 && !box.loadScene(argv[2]) )
+            return 1;
+        passed = box.checkFastMathImage() && passed;
+        return passed ? 0 : 1;
+    }
+
+    // "BasicViewer --check-projection" checks that the preview projects points like the ray caster
+    if ( argc == 2 && QString(argv[1]) == "--check-projection" )
+        return checkPrimaryProjection() ? 0 : 1;
+
     // check for OpenGL support
     if ( !QGLFormat::hasOpenGL() )
     {
@@ -22,6 +56,19 @@ int main( int argc, char** argv )
 
     // create the main window
     MainWindow main;
+    // "BasicViewer scene.scn" loads the given scene file instead of the built-in scene,
+    // "--profile-csv times.csv" writes the stage times of every frame to the file,
+    // "--trace trace.json" writes a Chrome trace of all frames
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( QString(argv[i]) == "--profile-csv" && i + 1 < argc )
+            main.getGLBox()->setProfileCsv(argv[++i]);
+        else if ( QString(argv[i]) == "--trace" && i + 1 < argc )
+            main.getGLBox()->setTraceFile(argv[++i]);
+        else
+            main.getGLBox()->loadScene(argv[i]);
+    }
+
     // set it as the main widget (so closing the window exits the program)
     app.setActiveWindow(&main);
 
@@ -2,6 +2,9 @@
 
 Material::Material()
 {
+    m_reflection = 0;
+    m_transparency = 0;
+    m_refractiveIndex = 1;
 }
 
 Material::Material(Vec3d diffuse, Vec3d specular, Vec3d ambient, double shininess)
@@ -10,6 +13,9 @@ Material::Material(Vec3d diffuse, Vec3d specular, Vec3d ambient, double shinines
     m_specular = specular;
     m_ambient = ambient;
     m_shininess = shininess;
+    m_reflection = 0;
+    m_transparency = 0;
+    m_refractiveIndex = 1;
 }
 
 Vec3d Material::getDiffuse()
@@ -36,3 +42,29 @@ void Material::setDiffuse(Vec3d diffuse)
 {
     m_diffuse = diffuse;
 }
+
+double Material::getReflection()
+{
+    return m_reflection;
+}
+
+void Material::setReflection(double reflection)
+{
+    m_reflection = reflection;
+}
+
+double Material::getTransparency()
+{
+    return m_transparency;
+}
+
+double Material::getRefractiveIndex()
+{
+    return m_refractiveIndex;
+}
+
+void Material::setRefraction(double transparency, double refractiveIndex)
+{
+    m_transparency = transparency;
+    m_refractiveIndex = refractiveIndex;
+}
@@ -20,11 +20,26 @@ public:
 
     void setDiffuse(Vec3d diffuse);
 
+    // Fraction of the color reflected by a mirror ray (0-1)
+    double getReflection();
+
+    void setReflection(double reflection);
+
+    // Fraction of the color passed on by a refracted ray (0-1), and the index of refraction
+    double getTransparency();
+
+    double getRefractiveIndex();
+
+    void setRefraction(double transparency, double refractiveIndex);
+
 private:
     Vec3d m_diffuse;
     Vec3d m_specular;
     Vec3d m_ambient;
     double m_shininess;
+    double m_reflection;
+    double m_transparency;
+    double m_refractiveIndex;
 };
 
 #endif // MATERIAL_H
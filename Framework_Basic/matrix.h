@@ -61,12 +61,18 @@ public:
         return m_data[i][j];
     }
 
+    // Direct access to the entries in row-major order.
+    const T *data() const
+    {
+        return &m_data[0][0];
+    }
+
 
     // Matrix<T, SIZE> operator +(const Matrix<T, SIZE> &mat);
     // Matrix<T, SIZE> operator -(const Matrix<T, SIZE> &mat);
 
     // Left-hand vector-matrix multiplication
-    Vector<T, SIZE> operator *(const Vector<T, SIZE> &vec)
+    Vector<T, SIZE> operator *(const Vector<T, SIZE> &vec) const
     {
         Vector<T, SIZE> buf;
         for (unsigned int j = 0; j < SIZE; j++)
@@ -76,7 +82,7 @@ public:
     }
 
     // Matrix multiplication
-    Matrix<T, SIZE> operator *(const Matrix<T, SIZE> &mat)
+    Matrix<T, SIZE> operator *(const Matrix<T, SIZE> &mat) const
     {
         Matrix<T, SIZE> result;
         for(unsigned int i = 0; i < SIZE; i++){
@@ -90,7 +96,7 @@ public:
     }
 
     // Compute the inverse of a 4x4 matrix.
-    // singular is set to false if the matrix is singular, else true.
+    // singular is set to true if the matrix is singular, else false.
     // Based on the work by Burkhard Lehner.
     Matrix<double, 4> inverse(bool &singular)
     {
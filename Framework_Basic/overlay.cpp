@@ -0,0 +1,215 @@
+#include "overlay.h"
+#include "bresenham.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+CoverageOverlay::CoverageOverlay()
+{
+    m_width = 0;
+    m_height = 0;
+    m_pitch = 2;
+    m_minY = 0;
+    m_maxY = -1;
+}
+
+void CoverageOverlay::clear(int width, int height)
+{
+    if(width != m_width || height != m_height)
+    {
+        m_width = width;
+        m_height = height;
+        m_pitch = width + 2;
+        m_pixels.assign(4*m_pitch*(height + 2), 0);
+    }
+    else if(m_minY <= m_maxY)
+    {
+        //Rows are stored with an offset of one, the touched rows and their border neighbours are cleared
+        memset(&m_pixels[4*m_pitch*m_minY], 0, 4*m_pitch*(m_maxY - m_minY + 3));
+    }
+    m_minY = m_height;
+    m_maxY = -1;
+}
+
+bool CoverageOverlay::isEmpty()
+{
+    return m_minY > m_maxY;
+}
+
+void CoverageOverlay::touchRows(int y1, int y2)
+{
+    m_minY = std::min(m_minY, std::max(y1, 0));
+    m_maxY = std::max(m_maxY, std::min(y2, m_height - 1));
+}
+
+inline void CoverageOverlay::plot(int x, int y, double coverage, const unsigned char color[3])
+{
+    int alpha = int(255.0*coverage + 0.5);
+    unsigned char *pixel = &m_pixels[4*((y + 1)*m_pitch + x + 1)];
+    if(alpha > pixel[3])
+    {
+        pixel[0] = color[0];
+        pixel[1] = color[1];
+        pixel[2] = color[2];
+        pixel[3] = alpha;
+    }
+}
+
+void CoverageOverlay::drawLine(double x1, double y1, double x2, double y2, const unsigned char color[3])
+{
+    //After clipping, the rounded end points lie inside the image and their neighbours inside the border
+    if(!clipLine(x1, y1, x2, y2, 0, 0, m_width - 1, m_height - 1))
+    {
+        return;
+    }
+    touchRows(int(floor(std::min(y1, y2))) - 1, int(floor(std::max(y1, y2))) + 1);
+
+    //Step along the major axis, coordinates are swapped for steep lines
+    bool steep = fabs(y2 - y1) > fabs(x2 - x1);
+    if(steep)
+    {
+        std::swap(x1, y1);
+        std::swap(x2, y2);
+    }
+    if(x1 > x2)
+    {
+        std::swap(x1, x2);
+        std::swap(y1, y2);
+    }
+    double dx = x2 - x1;
+    double gradient = dx == 0 ? 1 : (y2 - y1) / dx;
+
+    //End points, weighted with the part of their pixel covered by the line
+    int px1 = int(floor(x1 + 0.5));
+    int px2 = int(floor(x2 + 0.5));
+    double yEnd1 = y1 + gradient*(px1 - x1);
+    double yEnd2 = y2 + gradient*(px2 - x2);
+    double gap1 = 1 - (x1 + 0.5 - floor(x1 + 0.5));
+    double gap2 = x2 + 0.5 - floor(x2 + 0.5);
+    if(px1 == px2)
+    {
+        gap1 = x2 - x1;
+    }
+    int py1 = int(floor(yEnd1));
+    int py2 = int(floor(yEnd2));
+    double f1 = yEnd1 - py1;
+    double f2 = yEnd2 - py2;
+    if(steep)
+    {
+        plot(py1, px1, (1 - f1)*gap1, color);
+        plot(py1 + 1, px1, f1*gap1, color);
+    }
+    else
+    {
+        plot(px1, py1, (1 - f1)*gap1, color);
+        plot(px1, py1 + 1, f1*gap1, color);
+    }
+    if(px2 == px1)
+    {
+        return;
+    }
+    if(steep)
+    {
+        plot(py2, px2, (1 - f2)*gap2, color);
+        plot(py2 + 1, px2, f2*gap2, color);
+    }
+    else
+    {
+        plot(px2, py2, (1 - f2)*gap2, color);
+        plot(px2, py2 + 1, f2*gap2, color);
+    }
+
+    //Inner pixels, the coverage is split between the two pixels next to the line
+    double y = yEnd1 + gradient;
+    for(int x = px1 + 1; x < px2; x++, y += gradient)
+    {
+        int py = int(floor(y));
+        double f = y - py;
+        if(steep)
+        {
+            plot(py, x, 1 - f, color);
+            plot(py + 1, x, f, color);
+        }
+        else
+        {
+            plot(x, py, 1 - f, color);
+            plot(x, py + 1, f, color);
+        }
+    }
+}
+
+void CoverageOverlay::drawLines(const double *points, int count, const unsigned char color[3])
+{
+    for(int i=0; i<count; i++, points += 4)
+    {
+        drawLine(points[0], points[1], points[2], points[3], color);
+    }
+}
+
+void CoverageOverlay::plotCircle(int cx, int cy, int x, int y, double coverage, const unsigned char color[3], bool checked)
+{
+    int offsets[8][2] = {
+        { y,  x}, { x,  y}, {-x,  y}, {-y,  x},
+        {-y, -x}, {-x, -y}, { x, -y}, { y, -x}
+    };
+    for(int i=0; i<8; i++)
+    {
+        int px = cx + offsets[i][0];
+        int py = cy + offsets[i][1];
+        if(!checked || (px >= 0 && px < m_width && py >= 0 && py < m_height))
+        {
+            plot(px, py, coverage, color);
+        }
+    }
+}
+
+void CoverageOverlay::drawCircle(double cx, double cy, double radius, const unsigned char color[3])
+{
+    int x0 = int(floor(cx + 0.5));
+    int y0 = int(floor(cy + 0.5));
+    int extent = int(ceil(radius)) + 1;
+    if(radius <= 0 || x0 + extent < 0 || y0 + extent < 0 || x0 - extent >= m_width || y0 - extent >= m_height)
+    {
+        return;
+    }
+    touchRows(y0 - extent, y0 + extent);
+
+    //Only circles crossing the border of the image need to test their pixels
+    bool checked = x0 - extent < 0 || y0 - extent < 0 || x0 + extent >= m_width || y0 + extent >= m_height;
+
+    //First octant, the coverage is split between the two pixels next to the circle
+    double r2 = radius*radius;
+    int xEnd = int(ceil(radius / sqrt(2.0)));
+    for(int x = 0; x <= xEnd; x++)
+    {
+        double y = sqrt(std::max(r2 - x*x, 0.0));
+        int py = int(floor(y));
+        if(py < x)
+        {
+            break;
+        }
+        double f = y - py;
+        plotCircle(x0, y0, x, py, 1 - f, color, checked);
+        plotCircle(x0, y0, x, py + 1, f, color, checked);
+    }
+}
+
+void CoverageOverlay::composite(unsigned char *image, int stride)
+{
+    //Branch free per pixel, so the compiler can vectorize the inner loop
+    for(int y = m_minY; y <= m_maxY; y++)
+    {
+        const unsigned char *src = &m_pixels[4*((y + 1)*m_pitch + 1)];
+        unsigned char *dst = image + 3*y*stride;
+        for(int x = 0; x < m_width; x++, src += 4, dst += 3)
+        {
+            int alpha = src[3];
+            for(int c = 0; c < 3; c++)
+            {
+                //Rounded division by 255
+                int v = dst[c]*(255 - alpha) + src[c]*alpha + 128;
+                dst[c] = (v + (v >> 8)) >> 8;
+            }
+        }
+    }
+}
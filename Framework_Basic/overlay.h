@@ -0,0 +1,57 @@
+//
+// CoverageOverlay
+//
+// Anti-aliased lines and circles (Xiaolin Wu) drawn as coverage into an RGBA buffer of their
+// own and blended over the rendered image in one pass by composite(). Where primitives
+// overlap, the larger coverage wins, so joints of lines do not get darker.
+// Coordinates are pixel positions of the image, i.e. [0, width) x [0, height).
+//
+
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <vector>
+
+class CoverageOverlay
+{
+public:
+    CoverageOverlay();
+
+    // Remove all primitives and resize the overlay to width x height pixels
+    void clear(int width, int height);
+
+    // Draw the line between two points with the given RGB color
+    void drawLine(double x1, double y1, double x2, double y2, const unsigned char color[3]);
+
+    // Draw count lines, segment i runs from points[4*i], points[4*i+1] to points[4*i+2], points[4*i+3]
+    void drawLines(const double *points, int count, const unsigned char color[3]);
+
+    // Draw the outline of a circle, the center is rounded to the nearest pixel
+    void drawCircle(double cx, double cy, double radius, const unsigned char color[3]);
+
+    // Blend the overlay over the top left width x height pixels of an RGB image with
+    // stride pixels per row. Only rows touched since clear() are processed.
+    void composite(unsigned char *image, int stride);
+
+    bool isEmpty();
+
+private:
+    // Writes the coverage of one pixel, x and y may lie in the guard border
+    void plot(int x, int y, double coverage, const unsigned char color[3]);
+
+    // plot() for the eight points symmetric to (x, y) around the center of a circle
+    void plotCircle(int cx, int cy, int x, int y, double coverage, const unsigned char color[3], bool checked);
+
+    void touchRows(int y1, int y2);
+
+    // RGBA, not premultiplied. The buffer has a guard border of one pixel around the image,
+    // so the pixel pairs of clipped lines never leave it.
+    std::vector<unsigned char> m_pixels;
+    int m_width;
+    int m_height;
+    int m_pitch;    // Pixels per row including the border
+    int m_minY;     // Rows touched since clear(), m_minY > m_maxY if none
+    int m_maxY;
+};
+
+#endif // OVERLAY_H
@@ -0,0 +1,161 @@
+#include "profiler.h"
+#include <QMutexLocker>
+#include <QTextStream>
+
+Profiler::Profiler()
+{
+    m_enabled = 0;
+    m_frame = 0;
+    for(int i=0; i<STAGE_COUNT; i++)
+    {
+        m_current[i] = 0;
+        m_last[i] = 0;
+    }
+    m_clock.start();
+}
+
+Profiler::~Profiler()
+{
+    setCsvFile(QString());
+}
+
+void Profiler::setEnabled(bool enabled)
+{
+    m_enabled = enabled ? 1 : 0;
+}
+
+bool Profiler::setCsvFile(QString filename)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if(m_csv.isOpen())
+    {
+        m_csv.close();
+    }
+    if(filename.isEmpty())
+    {
+        return true;
+    }
+
+    m_csv.setFileName(filename);
+    if(!m_csv.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        return false;
+    }
+
+    QTextStream out(&m_csv);
+    out << "frame";
+    for(int i=0; i<STAGE_COUNT; i++)
+    {
+        out << "," << getStageName(ProfileStage(i)) << "_ms";
+    }
+    out << ",primary_rays,shadow_rays,sphere_tests,triangle_tests,hits,texture_fetches,aa_samples,refined_fraction,secondary_rays,rays_per_sec\n";
+    return true;
+}
+
+void Profiler::endFrame()
+{
+    QMutexLocker locker(&m_mutex);
+
+    for(int i=0; i<STAGE_TEXTURE_UPLOAD; i++)
+    {
+        m_last[i] = m_current[i];
+        m_current[i] = 0;
+    }
+    m_lastStats = m_currentStats;
+    m_currentStats = RayStats();
+    m_frame++;
+
+    //The GUI stages are those of the last paint, they belong to an earlier frame
+    if(m_csv.isOpen())
+    {
+        QTextStream out(&m_csv);
+        out << m_frame;
+        for(int i=0; i<STAGE_COUNT; i++)
+        {
+            out << "," << m_last[i] / 1.0e6;
+        }
+        out << "," << m_lastStats.primaryRays << "," << m_lastStats.shadowRays
+            << "," << m_lastStats.sphereTests << "," << m_lastStats.triangleTests << "," << m_lastStats.hits
+            << "," << m_lastStats.textureFetches << "," << m_lastStats.aaSamples << "," << m_lastStats.getRefinedFraction()
+            << "," << m_lastStats.secondaryRays << "," << raysPerSecond() << "\n";
+    }
+}
+
+void Profiler::discardFrame()
+{
+    QMutexLocker locker(&m_mutex);
+
+    for(int i=0; i<STAGE_TEXTURE_UPLOAD; i++)
+    {
+        m_current[i] = 0;
+    }
+    m_currentStats = RayStats();
+}
+
+void Profiler::endPaint()
+{
+    QMutexLocker locker(&m_mutex);
+
+    for(int i=STAGE_TEXTURE_UPLOAD; i<STAGE_COUNT; i++)
+    {
+        m_last[i] = m_current[i];
+        m_current[i] = 0;
+    }
+}
+
+void Profiler::addStats(const RayStats &stats)
+{
+    QMutexLocker locker(&m_mutex);
+    m_currentStats += stats;
+}
+
+RayStats Profiler::getStats()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_lastStats;
+}
+
+double Profiler::getRaysPerSecond()
+{
+    QMutexLocker locker(&m_mutex);
+    return raysPerSecond();
+}
+
+double Profiler::raysPerSecond()
+{
+    qint64 renderTime = 0;
+    for(int i=0; i<STAGE_TEXTURE_UPLOAD; i++)
+    {
+        renderTime += m_last[i];
+    }
+    if(renderTime == 0)
+    {
+        return 0;
+    }
+    return (m_lastStats.primaryRays + m_lastStats.aaSamples + m_lastStats.secondaryRays + m_lastStats.shadowRays) * 1.0e9 / renderTime;
+}
+
+double Profiler::getStageTime(ProfileStage stage)
+{
+    QMutexLocker locker(&m_mutex);
+    return m_last[stage] / 1.0e6;
+}
+
+const char *Profiler::getStageName(ProfileStage stage)
+{
+    switch(stage)
+    {
+    case STAGE_RAY_GENERATION: return "ray_generation";
+    case STAGE_INTERSECTION:   return "intersection";
+    case STAGE_TEXTURE_LOOKUP: return "texture_lookup";
+    case STAGE_SHADOW_RAYS:    return "shadow_rays";
+    case STAGE_PHONG:          return "phong";
+    case STAGE_SECONDARY_RAYS: return "secondary_rays";
+    case STAGE_BUFFER_WRITE:   return "buffer_write";
+    case STAGE_ANTIALIASING:   return "antialiasing";
+    case STAGE_TEXTURE_UPLOAD: return "texture_upload";
+    case STAGE_PAINT:          return "paint";
+    default:                   return "unknown";
+    }
+}
@@ -0,0 +1,166 @@
+//
+// Profiler
+//
+// Per-stage frame timing. ScopedTimer measures the time spent in a block and adds it to
+// the stage of the current frame; the totals are published once per frame and can be
+// streamed to a CSV file. When the profiler is disabled a ScopedTimer only tests a flag.
+//
+// RayStats counts the work of the ray caster. The counts of a tile are collected in a local
+// RayStats and added to the frame with addStats().
+//
+// Every stage is owned by exactly one thread: the render stages by the render thread,
+// STAGE_TEXTURE_UPLOAD and STAGE_PAINT by the GUI thread. Each thread publishes its
+// stages with endFrame() or endPaint(). Tile workers time into their own arrays, which the
+// render thread adds after the frame, so render stages are CPU time summed over all workers.
+//
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QFile>
+#include <QString>
+
+enum ProfileStage
+{
+    STAGE_RAY_GENERATION,
+    STAGE_INTERSECTION,
+    STAGE_TEXTURE_LOOKUP,
+    STAGE_SHADOW_RAYS,
+    STAGE_PHONG,
+    STAGE_SECONDARY_RAYS,
+    STAGE_BUFFER_WRITE,
+    STAGE_ANTIALIASING,
+    STAGE_TEXTURE_UPLOAD,   // GUI thread
+    STAGE_PAINT,            // GUI thread, includes STAGE_TEXTURE_UPLOAD
+    STAGE_COUNT
+};
+
+// Work counters of the ray caster
+struct RayStats
+{
+    RayStats() : primaryRays(0), shadowRays(0), sphereTests(0), triangleTests(0), hits(0), textureFetches(0),
+        aaSamples(0), refinedPixels(0), secondaryRays(0) {}
+
+    RayStats &operator +=(const RayStats &stats)
+    {
+        primaryRays += stats.primaryRays;
+        shadowRays += stats.shadowRays;
+        sphereTests += stats.sphereTests;
+        triangleTests += stats.triangleTests;
+        hits += stats.hits;
+        textureFetches += stats.textureFetches;
+        aaSamples += stats.aaSamples;
+        refinedPixels += stats.refinedPixels;
+        secondaryRays += stats.secondaryRays;
+        return *this;
+    }
+
+    // Fraction of the pixels that got extra anti-aliasing samples
+    double getRefinedFraction() const
+    {
+        return primaryRays > 0 ? refinedPixels / double(primaryRays) : 0;
+    }
+
+    qint64 primaryRays;
+    qint64 shadowRays;
+    qint64 sphereTests;     // Primary and shadow ray sphere intersections
+    qint64 triangleTests;   // Primary and shadow ray triangle intersections
+    qint64 hits;            // Primary rays hitting a sphere or mesh
+    qint64 textureFetches;
+    qint64 aaSamples;       // Extra primary rays of the anti-aliasing pass
+    qint64 refinedPixels;   // Pixels that got them, primaryRays counts one ray per pixel
+    qint64 secondaryRays;   // Reflected and refracted rays
+};
+
+class Profiler
+{
+public:
+    Profiler();
+    ~Profiler();
+
+    void setEnabled(bool enabled);
+
+    bool isEnabled() { return m_enabled != 0; }
+
+    // Stream the times of every frame to the file, an empty filename closes it.
+    // Returns false if the file cannot be opened.
+    bool setCsvFile(QString filename);
+
+    // Nanoseconds since the profiler was created
+    qint64 now() { return m_clock.nsecsElapsed(); }
+
+    // Add time to a stage of the current frame (only from the thread owning the stage)
+    void add(ProfileStage stage, qint64 nsecs) { m_current[stage] += nsecs; }
+
+    // Add the counters of a tile to the current frame (from any thread)
+    void addStats(const RayStats &stats);
+
+    // Render thread: publish the render stages of the finished frame and write the CSV row
+    void endFrame();
+
+    // Render thread: drop the render stages and counters of a cancelled frame
+    void discardFrame();
+
+    // GUI thread: publish the GUI stages of the last paintGL()
+    void endPaint();
+
+    // Milliseconds of the stage in the last published frame
+    double getStageTime(ProfileStage stage);
+
+    // Counters of the last published frame
+    RayStats getStats();
+
+    // Primary, anti-aliasing, secondary and shadow rays per second of render time in the last published frame
+    double getRaysPerSecond();
+
+    // Human readable name of the stage
+    static const char *getStageName(ProfileStage stage);
+
+private:
+    // getRaysPerSecond() without locking
+    double raysPerSecond();
+
+    QAtomicInt m_enabled;
+    QElapsedTimer m_clock;
+    qint64 m_current[STAGE_COUNT];  // Stages of the frame in progress, written by the owning thread
+    qint64 m_last[STAGE_COUNT];     // Last published frame, guarded by m_mutex
+    RayStats m_currentStats;        // Guarded by m_mutex
+    RayStats m_lastStats;
+    QMutex m_mutex;
+    QFile m_csv;
+    int m_frame;
+};
+
+// Adds the lifetime of the object to a stage of the profiler, or to times[stage] if given.
+class ScopedTimer
+{
+public:
+    ScopedTimer(Profiler &profiler, ProfileStage stage, qint64 *times = NULL)
+        : m_profiler(profiler), m_stage(stage), m_times(times)
+    {
+        m_start = m_profiler.isEnabled() ? m_profiler.now() : -1;
+    }
+
+    ~ScopedTimer()
+    {
+        if(m_start >= 0 && m_times)
+        {
+            m_times[m_stage] += m_profiler.now() - m_start;
+        }
+        else if(m_start >= 0)
+        {
+            m_profiler.add(m_stage, m_profiler.now() - m_start);
+        }
+    }
+
+private:
+    Profiler &m_profiler;
+    ProfileStage m_stage;
+    qint64 *m_times;
+    qint64 m_start;
+};
+
+#endif // PROFILER_H
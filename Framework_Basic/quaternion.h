@@ -0,0 +1,179 @@
+//
+// Quaternion
+//
+// Unit quaternion representation of rotations in 3D.
+// Rotating a point costs a few multiply-adds, compared to building the rotation
+// from several 4x4 matrices as done by Matrix::makeRotMat().
+//
+
+#ifndef QUATERNION_H
+#define QUATERNION_H
+
+#include <math.h>
+#include "vector.h"
+#include "matrix.h"
+
+template<class T>
+class Quaternion
+{
+public:
+    // Standard constructor, identity rotation.
+    Quaternion<T>()
+    {
+        m_w = T(1);
+        m_x = T(0);
+        m_y = T(0);
+        m_z = T(0);
+    }
+
+    // Constructor with the real part w and the imaginary part (x, y, z).
+    Quaternion<T>(T w, T x, T y, T z)
+    {
+        m_w = w;
+        m_x = x;
+        m_y = y;
+        m_z = z;
+    }
+
+    // Rotation by angle around axis. The axis need not be normalized,
+    // the homogeneous coordinate is ignored.
+    // Uses the same orientation as Matrix::makeRotMat(angle, axis).
+    static Quaternion<T> fromAxisAngle(const Vector<T, 4> &axis, T angle)
+    {
+        T length = sqrt(axis(0)*axis(0) + axis(1)*axis(1) + axis(2)*axis(2));
+        if (length == T(0))
+            return Quaternion<T>();     // No axis, no rotation
+
+        T s = sin(angle/2) / length;
+        return Quaternion<T>(cos(angle/2), axis(0)*s, axis(1)*s, axis(2)*s);
+    }
+
+    T w() const { return m_w; }
+    T x() const { return m_x; }
+    T y() const { return m_y; }
+    T z() const { return m_z; }
+
+    // Composition: (q1*q2) rotates by q2 first, then by q1.
+    Quaternion<T> operator *(const Quaternion<T> &q) const
+    {
+        return Quaternion<T>(m_w*q.m_w - m_x*q.m_x - m_y*q.m_y - m_z*q.m_z,
+                             m_w*q.m_x + m_x*q.m_w + m_y*q.m_z - m_z*q.m_y,
+                             m_w*q.m_y - m_x*q.m_z + m_y*q.m_w + m_z*q.m_x,
+                             m_w*q.m_z + m_x*q.m_y - m_y*q.m_x + m_z*q.m_w);
+    }
+
+    // Inverse rotation (for unit quaternions).
+    Quaternion<T> conjugate() const
+    {
+        return Quaternion<T>(m_w, -m_x, -m_y, -m_z);
+    }
+
+    T dot(const Quaternion<T> &q) const
+    {
+        return m_w*q.m_w + m_x*q.m_x + m_y*q.m_y + m_z*q.m_z;
+    }
+
+    // Normalizes the quaternion to length 1, e.g. after many compositions.
+    Quaternion<T> norm() const
+    {
+        T length = sqrt(dot(*this));
+        if (length == T(0))
+            return Quaternion<T>();
+        return Quaternion<T>(m_w/length, m_x/length, m_y/length, m_z/length);
+    }
+
+    // Spherical linear interpolation between q1 (t=0) and q2 (t=1) along the shortest arc.
+    static Quaternion<T> slerp(const Quaternion<T> &q1, const Quaternion<T> &q2, T t)
+    {
+        Quaternion<T> q3 = q2;
+        T cosOmega = q1.dot(q2);
+        if (cosOmega < T(0))
+        {
+            q3 = Quaternion<T>(-q2.m_w, -q2.m_x, -q2.m_y, -q2.m_z);
+            cosOmega = -cosOmega;
+        }
+
+        T k1, k2;
+        if (cosOmega > T(0.9995))
+        {
+            // Nearly parallel: linear interpolation is accurate and avoids the division by sin(omega)
+            k1 = T(1) - t;
+            k2 = t;
+        }
+        else
+        {
+            T omega = acos(cosOmega);
+            T sinOmega = sin(omega);
+            k1 = sin((T(1) - t)*omega) / sinOmega;
+            k2 = sin(t*omega) / sinOmega;
+        }
+
+        return Quaternion<T>(k1*q1.m_w + k2*q3.m_w,
+                             k1*q1.m_x + k2*q3.m_x,
+                             k1*q1.m_y + k2*q3.m_y,
+                             k1*q1.m_z + k2*q3.m_z).norm();
+    }
+
+    // Rotates the vector around the origin. The homogeneous coordinate is kept.
+    Vector<T, 4> rotate(const Vector<T, 4> &vec) const
+    {
+        // v' = v + w*t + q x t with t = 2 * (q x v)
+        T tx = 2 * (m_y*vec(2) - m_z*vec(1));
+        T ty = 2 * (m_z*vec(0) - m_x*vec(2));
+        T tz = 2 * (m_x*vec(1) - m_y*vec(0));
+        return Vector<T, 4>(vec(0) + m_w*tx + m_y*tz - m_z*ty,
+                            vec(1) + m_w*ty + m_z*tx - m_x*tz,
+                            vec(2) + m_w*tz + m_x*ty - m_y*tx,
+                            vec(3));
+    }
+
+    // Rotates the point around the given center point.
+    Vector<T, 4> rotatePoint(const Vector<T, 4> &point, const Vector<T, 4> &center) const
+    {
+        Vector<T, 4> rel(point(0) - center(0), point(1) - center(1), point(2) - center(2), point(3));
+        Vector<T, 4> result = rotate(rel);
+        result(0) += center(0);
+        result(1) += center(1);
+        result(2) += center(2);
+        return result;
+    }
+
+    // Conversion to a 4x4 rotation matrix.
+    Matrix<T, 4> toMatrix() const
+    {
+        Matrix<T, 4> rotMat;
+        rotMat(0,0) = 1 - 2*(m_y*m_y + m_z*m_z);
+        rotMat(0,1) = 2*(m_x*m_y - m_w*m_z);
+        rotMat(0,2) = 2*(m_x*m_z + m_w*m_y);
+        rotMat(1,0) = 2*(m_x*m_y + m_w*m_z);
+        rotMat(1,1) = 1 - 2*(m_x*m_x + m_z*m_z);
+        rotMat(1,2) = 2*(m_y*m_z - m_w*m_x);
+        rotMat(2,0) = 2*(m_x*m_z - m_w*m_y);
+        rotMat(2,1) = 2*(m_y*m_z + m_w*m_x);
+        rotMat(2,2) = 1 - 2*(m_x*m_x + m_y*m_y);
+        rotMat(3,3) = 1;        //Other entries are 0
+        return rotMat;
+    }
+
+    // Conversion to a 4x4 matrix rotating around the given center point,
+    // equivalent to Matrix::makeRotMatPoint().
+    Matrix<T, 4> toMatrixPoint(const Vector<T, 4> &center) const
+    {
+        Matrix<T, 4> rotMat = toMatrix();
+        Vector<T, 4> rotCenter = rotate(center);
+        rotMat(0,3) = center(0) - rotCenter(0);
+        rotMat(1,3) = center(1) - rotCenter(1);
+        rotMat(2,3) = center(2) - rotCenter(2);
+        return rotMat;
+    }
+
+private:
+    T m_w;
+    T m_x, m_y, m_z;
+};
+
+// Some common quaternion classes
+typedef Quaternion<float> Quatf;
+typedef Quaternion<double> Quatd;
+
+#endif // QUATERNION_H
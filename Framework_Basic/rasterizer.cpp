@@ -0,0 +1,497 @@
+#include "rasterizer.h"
+#include "transform.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+// Front end ranges per thread, more ranges balance the load better
+#define RASTER_RANGES_PER_THREAD 4
+
+// Minimum number of triangles per front end range
+#define RASTER_MIN_RANGE 256
+
+// Runs one pass of the rasterizer on a thread of the pool
+class RasterJob : public QRunnable
+{
+public:
+    RasterJob(Rasterizer *rasterizer)
+    {
+        m_rasterizer = rasterizer;
+        m_frontEnd = true;
+        setAutoDelete(false);
+    }
+
+    void setFrontEnd(bool frontEnd)
+    {
+        m_frontEnd = frontEnd;
+    }
+
+    void run()
+    {
+        if(m_frontEnd)
+        {
+            m_rasterizer->setupRanges();
+        }
+        else
+        {
+            m_rasterizer->rasterizeTiles();
+        }
+    }
+
+private:
+    Rasterizer *m_rasterizer;
+    bool m_frontEnd;
+};
+
+Rasterizer::Rasterizer()
+{
+    m_buffer = NULL;
+    m_width = 0;
+    m_height = 0;
+    m_stride = 0;
+    m_frontCCW = true;
+    m_drawnTriangles = 0;
+    m_rangeCount = 0;
+    m_rangeSize = 0;
+    m_tilesX = 0;
+    m_tileCount = 0;
+}
+
+Rasterizer::~Rasterizer()
+{
+    for(unsigned int i=0; i<m_jobs.size(); i++)
+    {
+        delete m_jobs[i];
+    }
+}
+
+void Rasterizer::setFrontFace(bool counterClockwise)
+{
+    m_frontCCW = counterClockwise;
+}
+
+void Rasterizer::setTarget(unsigned char *buffer, int width, int height, int stride)
+{
+    m_buffer = buffer;
+    m_width = width;
+    m_height = height;
+    m_stride = stride;
+}
+
+void Rasterizer::beginFrame()
+{
+    m_triangles.clear();
+}
+
+int Rasterizer::getDrawnTriangles()
+{
+    return m_drawnTriangles;
+}
+
+void Rasterizer::drawTriangle(const RasterVertex &v0, const RasterVertex &v1, const RasterVertex &v2)
+{
+    m_triangles.push_back(v0);
+    m_triangles.push_back(v1);
+    m_triangles.push_back(v2);
+}
+
+void Rasterizer::endFrame(QThreadPool *pool)
+{
+    m_drawnTriangles = 0;
+    int triangleCount = m_triangles.size() / 3;
+    if(triangleCount == 0 || m_width <= 0 || m_height <= 0)
+    {
+        return;
+    }
+
+    int threads = pool ? std::max(1, pool->maxThreadCount()) : 1;
+    m_rangeCount = std::max(1, std::min(threads*RASTER_RANGES_PER_THREAD, triangleCount / RASTER_MIN_RANGE));
+    m_rangeSize = (triangleCount + m_rangeCount - 1) / m_rangeCount;
+    m_tilesX = (m_width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    m_tileCount = m_tilesX * ((m_height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE);
+
+    //The bins keep their memory from frame to frame
+    if(int(m_ranges.size()) < m_rangeCount)
+    {
+        m_ranges.resize(m_rangeCount);
+    }
+    for(int r=0; r<m_rangeCount; r++)
+    {
+        Range &range = m_ranges[r];
+        range.setups.clear();
+        range.drawn.clear();
+        range.bins.resize(m_tileCount);
+        for(int t=0; t<m_tileCount; t++)
+        {
+            range.bins[t].clear();
+        }
+    }
+
+    m_nextRange = 0;
+    m_nextTile = 0;
+    if(!pool)
+    {
+        setupRanges();
+        rasterizeTiles();
+    }
+    else
+    {
+        while(int(m_jobs.size()) < threads)
+        {
+            m_jobs.push_back(new RasterJob(this));
+        }
+
+        //The back end starts when all triangles are binned
+        for(int pass=0; pass<2; pass++)
+        {
+            for(int i=0; i<threads; i++)
+            {
+                m_jobs[i]->setFrontEnd(pass == 0);
+                pool->start(m_jobs[i]);
+            }
+            pool->waitForDone();
+        }
+    }
+
+    //A triangle spanning several tiles is counted once
+    for(int r=0; r<m_rangeCount; r++)
+    {
+        Range &range = m_ranges[r];
+        for(int t=0; t<m_tileCount; t++)
+        {
+            const std::vector<int> &bin = range.bins[t];
+            for(unsigned int i=0; i<bin.size(); i++)
+            {
+                if(bin[i] < 0)
+                {
+                    range.drawn[~bin[i]] = 1;
+                }
+            }
+        }
+        m_drawnTriangles += std::count(range.drawn.begin(), range.drawn.end(), 1);
+    }
+}
+
+// Point of the edge from a to b on the near plane
+static RasterVertex clipNear(const RasterVertex &a, const RasterVertex &b)
+{
+    double t = (a.pos(3) - RASTER_NEAR_W) / (a.pos(3) - b.pos(3));
+    RasterVertex v;
+    for(int i=0; i<4; i++)
+    {
+        v.pos(i) = a.pos(i) + t*(b.pos(i) - a.pos(i));
+    }
+    for(int i=0; i<3; i++)
+    {
+        v.color(i) = a.color(i) + t*(b.color(i) - a.color(i));
+    }
+    return v;
+}
+
+void Rasterizer::setupRanges()
+{
+    forever
+    {
+        int range = m_nextRange.fetchAndAddRelaxed(1);
+        if(range >= m_rangeCount)
+        {
+            return;
+        }
+        setupRange(range);
+    }
+}
+
+void Rasterizer::setupRange(int range)
+{
+    Range &out = m_ranges[range];
+    int first = range*m_rangeSize;
+    int last = std::min(first + m_rangeSize, int(m_triangles.size()) / 3);
+    for(int tri = first; tri < last; tri++)
+    {
+        const RasterVertex *in[3] = {&m_triangles[3*tri], &m_triangles[3*tri+1], &m_triangles[3*tri+2]};
+        bool inside[3];
+        int insideCount = 0;
+        for(int i=0; i<3; i++)
+        {
+            inside[i] = in[i]->pos(3) >= RASTER_NEAR_W;
+            if(inside[i]) insideCount++;
+        }
+
+        if(insideCount == 3)
+        {
+            setup(out, *in[0], *in[1], *in[2]);
+            continue;
+        }
+        if(insideCount == 0)
+        {
+            continue;
+        }
+
+        //Sutherland-Hodgman against the near plane, keeps the winding
+        RasterVertex clipped[4];
+        int count = 0;
+        for(int i=0; i<3; i++)
+        {
+            const RasterVertex &a = *in[i];
+            const RasterVertex &b = *in[(i+1) % 3];
+            if(inside[i])
+            {
+                clipped[count++] = a;
+            }
+            if(inside[i] != inside[(i+1) % 3])
+            {
+                clipped[count++] = clipNear(a, b);
+            }
+        }
+
+        setup(out, clipped[0], clipped[1], clipped[2]);
+        if(count == 4)
+        {
+            setup(out, clipped[0], clipped[2], clipped[3]);
+        }
+    }
+}
+
+Rasterizer::ScreenVertex Rasterizer::toScreen(const RasterVertex &v)
+{
+    ScreenVertex s;
+    s.invW = 1.0 / v.pos(3);
+    s.x = v.pos(0)*s.invW*0.5*m_width + 0.5*m_width;
+    s.y = v.pos(1)*s.invW*0.5*m_height + 0.5*m_height;
+    s.r = v.color(0)*s.invW;
+    s.g = v.color(1)*s.invW;
+    s.b = v.color(2)*s.invW;
+    return s;
+}
+
+void Rasterizer::setup(Range &range, const RasterVertex &v0, const RasterVertex &v1, const RasterVertex &v2)
+{
+    TriangleSetup t;
+    t.s[0] = toScreen(v0);
+    t.s[1] = toScreen(v1);
+    t.s[2] = toScreen(v2);
+    ScreenVertex *s = t.s;
+
+    //Twice the signed area, positive for counter-clockwise triangles
+    double area = (s[1].x - s[0].x)*(s[2].y - s[0].y) - (s[2].x - s[0].x)*(s[1].y - s[0].y);
+    if(!m_frontCCW)
+    {
+        //Clockwise front faces: swap two vertices, so the edge functions below stay positive inside
+        std::swap(s[1], s[2]);
+        area = -area;
+    }
+    if(area <= 0)
+    {
+        return;
+    }
+
+    t.minX = std::max(0, int(floor(std::min(s[0].x, std::min(s[1].x, s[2].x)))));
+    t.maxX = std::min(m_width - 1, int(ceil(std::max(s[0].x, std::max(s[1].x, s[2].x)))));
+    t.minY = std::max(0, int(floor(std::min(s[0].y, std::min(s[1].y, s[2].y)))));
+    t.maxY = std::min(m_height - 1, int(ceil(std::max(s[0].y, std::max(s[1].y, s[2].y)))));
+    if(t.minX > t.maxX || t.minY > t.maxY)
+    {
+        return;
+    }
+
+    //Pixels exactly on an edge belong to the triangle only for top and left edges.
+    for(int i=0; i<3; i++)
+    {
+        const ScreenVertex &p = s[(i+1) % 3];
+        const ScreenVertex &q = s[(i+2) % 3];
+        t.a[i] = (p.y - q.y) / area;
+        t.b[i] = (q.x - p.x) / area;
+        t.c[i] = (p.x*q.y - q.x*p.y) / area;
+        t.topLeft[i] = (p.y == q.y && q.x < p.x) || q.y < p.y;
+    }
+
+    int index = range.setups.size();
+    range.setups.push_back(t);
+    range.drawn.push_back(0);
+
+    //Bin into every tile overlapped by the bounding box, unless an edge excludes the whole tile
+    int tileX0 = t.minX / RASTER_TILE_SIZE;
+    int tileX1 = t.maxX / RASTER_TILE_SIZE;
+    int tileY0 = t.minY / RASTER_TILE_SIZE;
+    int tileY1 = t.maxY / RASTER_TILE_SIZE;
+    for(int ty = tileY0; ty <= tileY1; ty++)
+    {
+        for(int tx = tileX0; tx <= tileX1; tx++)
+        {
+            bool outside = false;
+            if(tileX0 != tileX1 || tileY0 != tileY1)
+            {
+                //Corner of the tile with the largest value of each edge function
+                double x0 = tx*RASTER_TILE_SIZE + 0.5;
+                double y0 = ty*RASTER_TILE_SIZE + 0.5;
+                double x1 = x0 + RASTER_TILE_SIZE - 1;
+                double y1 = y0 + RASTER_TILE_SIZE - 1;
+                for(int i=0; i<3 && !outside; i++)
+                {
+                    double x = t.a[i] > 0 ? x1 : x0;
+                    double y = t.b[i] > 0 ? y1 : y0;
+                    outside = t.a[i]*x + t.b[i]*y + t.c[i] < 0;
+                }
+            }
+            if(!outside)
+            {
+                range.bins[ty*m_tilesX + tx].push_back(index);
+            }
+        }
+    }
+}
+
+void Rasterizer::rasterizeTiles()
+{
+    float depth[RASTER_TILE_SIZE*RASTER_TILE_SIZE];
+    forever
+    {
+        int tile = m_nextTile.fetchAndAddRelaxed(1);
+        if(tile >= m_tileCount)
+        {
+            return;
+        }
+        int x0 = (tile % m_tilesX)*RASTER_TILE_SIZE;
+        int y0 = (tile / m_tilesX)*RASTER_TILE_SIZE;
+        int x1 = std::min(x0 + RASTER_TILE_SIZE, m_width) - 1;
+        int y1 = std::min(y0 + RASTER_TILE_SIZE, m_height) - 1;
+
+        //1/w of the nearest triangle per pixel of the tile, 0 if none
+        std::fill(depth, depth + RASTER_TILE_SIZE*RASTER_TILE_SIZE, 0.0f);
+        for(int r=0; r<m_rangeCount; r++)
+        {
+            Range &range = m_ranges[r];
+            std::vector<int> &bin = range.bins[tile];
+            for(unsigned int i=0; i<bin.size(); i++)
+            {
+                if(rasterize(range.setups[bin[i]], x0, y0, x1, y1, depth))
+                {
+                    //Only this job writes the bin, the flags are merged in endFrame()
+                    bin[i] = ~bin[i];
+                }
+            }
+        }
+    }
+}
+
+bool Rasterizer::rasterize(const TriangleSetup &t, int x0, int y0, int x1, int y1, float *depthTile)
+{
+    int minX = std::max(t.minX, x0);
+    int maxX = std::min(t.maxX, x1);
+    int minY = std::max(t.minY, y0);
+    int maxY = std::min(t.maxY, y1);
+    const ScreenVertex *s = t.s;
+    const double *a = t.a;
+    const double *b = t.b;
+    const double *c = t.c;
+    const bool *topLeft = t.topLeft;
+
+    bool drawn = false;
+    for(int y = minY; y <= maxY; y++)
+    {
+        double py = y + 0.5;
+        double px = minX + 0.5;
+        double e0 = a[0]*px + b[0]*py + c[0];
+        double e1 = a[1]*px + b[1]*py + c[1];
+        double e2 = a[2]*px + b[2]*py + c[2];
+        float *depth = &depthTile[(y - y0)*RASTER_TILE_SIZE + (minX - x0)];
+        unsigned char *pixel = &m_buffer[3*(y*m_stride + minX)];
+
+        for(int x = minX; x <= maxX; x++, e0 += a[0], e1 += a[1], e2 += a[2], depth++, pixel += 3)
+        {
+            if(e0 < 0 || e1 < 0 || e2 < 0)
+            {
+                continue;
+            }
+            if((e0 == 0 && !topLeft[0]) || (e1 == 0 && !topLeft[1]) || (e2 == 0 && !topLeft[2]))
+            {
+                continue;
+            }
+
+            //e_i are the barycentric coordinates, 1/w and color/w are affine in screen space
+            double invW = e0*s[0].invW + e1*s[1].invW + e2*s[2].invW;
+            if(invW <= *depth)
+            {
+                continue;
+            }
+            *depth = float(invW);
+
+            double w = 1.0 / invW;
+            double r = (e0*s[0].r + e1*s[1].r + e2*s[2].r)*w;
+            double g = (e0*s[0].g + e1*s[1].g + e2*s[2].g)*w;
+            double bl = (e0*s[0].b + e1*s[1].b + e2*s[2].b)*w;
+            pixel[0] = (unsigned char)(255.0*std::min(std::max(r, 0.0), 1.0));
+            pixel[1] = (unsigned char)(255.0*std::min(std::max(g, 0.0), 1.0));
+            pixel[2] = (unsigned char)(255.0*std::min(std::max(bl, 0.0), 1.0));
+            drawn = true;
+        }
+    }
+    return drawn;
+}
+
+bool checkPrimaryProjection()
+{
+    //Full and reduced resolution, the default and a short focus
+    static const int sizes[2][2] = {{400, 400}, {203, 117}};
+    static const double focuses[2] = {1000, 1.5};
+    static const double depths[3] = {0.25, 1, 4};
+
+    int checked = 0;
+    int failed = 0;
+    for(int s=0; s<2; s++)
+    {
+        int width = sizes[s][0];
+        int height = sizes[s][1];
+        std::vector<unsigned char> buffer(3*width*height);
+        Rasterizer rasterizer;
+        rasterizer.setTarget(&buffer[0], width, height, width);
+        int pixels[5][2] = {{0, 0}, {width-1, 0}, {0, height-1}, {width-1, height-1}, {width/3, height/2}};
+
+        for(int f=0; f<2; f++)
+        {
+            Mat4d projMat = makePrimaryProjMat(width, height, focuses[f]);
+            for(int p=0; p<5; p++)
+            {
+                for(int d=0; d<3; d++)
+                {
+                    //Point on the ray of the pixel, eye at (0, 0, focus)
+                    int x = pixels[p][0];
+                    int y = pixels[p][1];
+                    Vec3d dir = makePrimaryRay(x, y, width, height, focuses[f]);
+                    Vec4d point(depths[d]*dir(0), depths[d]*dir(1), focuses[f] + depths[d]*dir(2), 1);
+                    Vec4d pos = projMat*point;
+
+                    //Triangle a quarter pixel around the projected point, counter-clockwise
+                    static const double offsets[3][2] = {{-0.25, -0.25}, {0.25, -0.25}, {0, 0.25}};
+                    RasterVertex v[3];
+                    for(int i=0; i<3; i++)
+                    {
+                        v[i].pos = Vec4d(pos(0) + offsets[i][0]*2.0/width*pos(3), pos(1) + offsets[i][1]*2.0/height*pos(3), pos(2), pos(3));
+                        v[i].color = Vec3d(1, 1, 1);
+                    }
+                    memset(&buffer[0], 0, buffer.size());
+                    rasterizer.beginFrame();
+                    rasterizer.drawTriangle(v[0], v[1], v[2]);
+                    rasterizer.endFrame();
+
+                    //Exactly the pixel of the ray is covered
+                    int covered = 0;
+                    for(int i=0; i<width*height; i++)
+                    {
+                        covered += buffer[3*i] != 0;
+                    }
+                    checked++;
+                    if(covered != 1 || buffer[3*(y*width + x)] == 0)
+                    {
+                        printf("pixel (%d, %d) of %dx%d, focus %g, depth %g: not rasterized into its pixel\n",
+                               x, y, width, height, focuses[f], depths[d]);
+                        failed++;
+                    }
+                }
+            }
+        }
+    }
+    printf("Primary projection: %d of %d points on their pixel: %s\n", checked - failed, checked, failed ? "FAILED" : "ok");
+    return failed == 0;
+}
@@ -0,0 +1,131 @@
+//
+// Rasterizer
+//
+// Sort-middle half-space triangle rasterizer with a depth buffer, used for the fast preview
+// of the scene (see GLBox::rasterize()). Triangles are given in the homogeneous coordinates
+// produced by the projection of the ray caster (makePrimaryProjMat()); they are clipped against
+// the near plane w = RASTER_NEAR_W and mapped from [-1, 1] to the pixels of the target.
+// Colors are interpolated perspective-correct, the depth test uses 1/w.
+//
+// drawTriangle() only collects the triangles. endFrame() renders them in two parallel
+// passes on a thread pool: the front end sets up contiguous ranges of triangles and bins
+// them into the screen tiles they overlap, one bin list per range and tile. The back end
+// then rasterizes whole tiles independently with a depth buffer of RASTER_TILE_SIZE^2
+// floats that stays in the cache. Bins are visited in submission order, so the image is
+// the same as with a single thread.
+//
+
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <vector>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include "vector.h"
+
+// Near plane in homogeneous w
+#define RASTER_NEAR_W 1e-3
+
+// Edge length of the screen tiles in pixels
+#define RASTER_TILE_SIZE 32
+
+struct RasterVertex
+{
+    Vec4d pos;      // Homogeneous coordinates after the view-projection matrix
+    Vec3d color;    // RGB in [0,1]
+};
+
+class RasterJob;
+
+class Rasterizer
+{
+public:
+    Rasterizer();
+    ~Rasterizer();
+
+    // Render into the top left width x height pixels of an RGB buffer with stride pixels per row.
+    void setTarget(unsigned char *buffer, int width, int height, int stride);
+
+    // Discard all collected triangles
+    void beginFrame();
+
+    // Winding of front facing triangles on the screen, counter-clockwise by default.
+    // A mirroring view matrix turns the winding of the scene around.
+    void setFrontFace(bool counterClockwise);
+
+    // Collect a triangle, back faces are culled when the frame is rendered.
+    void drawTriangle(const RasterVertex &v0, const RasterVertex &v1, const RasterVertex &v2);
+
+    // Render all triangles collected since beginFrame(), on the pool if given
+    void endFrame(QThreadPool *pool = NULL);
+
+    // Number of triangles that covered at least one pixel center in the last frame
+    int getDrawnTriangles();
+
+    // Front end: set up and bin ranges of triangles until all are taken. Called by the jobs.
+    void setupRanges();
+
+    // Back end: rasterize tiles until all are taken. Called by the jobs.
+    void rasterizeTiles();
+
+private:
+    // Screen space vertex: pixel coordinates, 1/w and color/w
+    struct ScreenVertex
+    {
+        double x, y;
+        double invW;
+        double r, g, b;
+    };
+
+    // Edge functions and interpolation data of a front facing triangle.
+    // Edge i lies opposite vertex i: e_i(x,y) = a_i*x + b_i*y + c_i, positive inside.
+    struct TriangleSetup
+    {
+        double a[3], b[3], c[3];
+        bool topLeft[3];
+        ScreenVertex s[3];
+        int minX, maxX, minY, maxY;
+    };
+
+    // Triangles set up by one front end range and their bins
+    struct Range
+    {
+        std::vector<TriangleSetup> setups;
+        std::vector<std::vector<int> > bins;   // Setup indices per tile, complemented once drawn
+        std::vector<char> drawn;                // Per setup: covered a pixel center
+    };
+
+    // Set up and bin the triangles of one range
+    void setupRange(int range);
+
+    // Set up a triangle in front of the near plane and add it to the bins of the range
+    void setup(Range &range, const RasterVertex &v0, const RasterVertex &v1, const RasterVertex &v2);
+
+    // Rasterize the part of a triangle inside a tile, with the depth buffer of the tile
+    bool rasterize(const TriangleSetup &t, int x0, int y0, int x1, int y1, float *depth);
+
+    ScreenVertex toScreen(const RasterVertex &v);
+
+    unsigned char *m_buffer;
+    int m_width;
+    int m_height;
+    int m_stride;
+    bool m_frontCCW;
+    int m_drawnTriangles;
+
+    std::vector<RasterVertex> m_triangles;  // Three vertices per collected triangle
+    std::vector<Range> m_ranges;
+    std::vector<RasterJob*> m_jobs;
+    int m_rangeCount;       // Ranges of the current frame
+    int m_rangeSize;        // Triangles per range
+    int m_tilesX;
+    int m_tileCount;
+    QAtomicInt m_nextTile;  // Next tile taken by the back end
+    QAtomicInt m_nextRange; // Next range taken by the front end
+};
+
+// Rasterize points on the primary rays of the ray caster with makePrimaryProjMat() and check
+// that each lands on the pixel of its ray. Prints the result, returns false on a mismatch.
+bool checkPrimaryProjection();
+
+#endif // RASTERIZER_H
@@ -0,0 +1,63 @@
+#include "renderthread.h"
+#include "glbox.h"
+
+RenderThread::RenderThread(GLBox *box, int bufferSize)
+    : QThread(box), m_frames(bufferSize)
+{
+    m_box = box;
+    m_requested = false;
+    m_quit = false;
+}
+
+RenderThread::~RenderThread()
+{
+    stop();
+}
+
+void RenderThread::requestFrame()
+{
+    QMutexLocker locker(&m_mutex);
+    m_requested = true;
+    m_wake.wakeOne();
+}
+
+void RenderThread::stop()
+{
+    m_mutex.lock();
+    m_quit = true;
+    m_wake.wakeOne();
+    m_mutex.unlock();
+    wait();
+}
+
+FrameBuffers &RenderThread::getFrames()
+{
+    return m_frames;
+}
+
+void RenderThread::run()
+{
+    forever
+    {
+        m_mutex.lock();
+        while(!m_requested && !m_quit)
+        {
+            m_wake.wait(&m_mutex);
+        }
+        if(m_quit)
+        {
+            m_mutex.unlock();
+            return;
+        }
+        m_requested = false;
+        m_mutex.unlock();
+
+        double scale;
+        if(m_box->renderFrame(m_frames.getBack(), scale))
+        {
+            m_frames.setBackScale(scale);
+            m_frames.publish();
+            emit frameReady();
+        }
+    }
+}
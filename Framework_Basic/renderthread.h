@@ -0,0 +1,55 @@
+//
+// RenderThread
+//
+// Renders the frames of a GLBox on a dedicated thread, so slow frames do not block the GUI.
+// The GUI posts its input to the GLBox and calls requestFrame(); all requests that arrive
+// while a frame is rendered are merged into one following frame with the latest state.
+// Finished frames are handed over through FrameBuffers, frameReady() is emitted for each.
+// Requests that change nothing in the image do not produce a frame.
+//
+
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include "framebuffers.h"
+
+class GLBox;
+
+class RenderThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    RenderThread(GLBox *box, int bufferSize);
+
+    ~RenderThread();
+
+    // Ask for a new frame. Returns immediately.
+    void requestFrame();
+
+    // Finish the current frame and end the thread.
+    void stop();
+
+    FrameBuffers &getFrames();
+
+signals:
+    // A new frame has been published in the frame buffers.
+    void frameReady();
+
+protected:
+    void run();
+
+private:
+    GLBox *m_box;
+    FrameBuffers m_frames;
+
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    bool m_requested;   // A frame was requested since the last one started
+    bool m_quit;
+};
+
+#endif // RENDERTHREAD_H
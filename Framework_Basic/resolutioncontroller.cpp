@@ -0,0 +1,85 @@
+#include "resolutioncontroller.h"
+#include <math.h>
+#include <algorithm>
+
+ResolutionController::ResolutionController()
+{
+    m_target = 0;
+    m_average = -1;
+    m_scale = 1;
+    m_shadows = true;
+}
+
+void ResolutionController::setTargetFrameTime(double ms)
+{
+    m_target = ms;
+    if(m_target <= 0)
+    {
+        m_scale = 1;
+        m_shadows = true;
+    }
+}
+
+double ResolutionController::getTargetFrameTime()
+{
+    return m_target;
+}
+
+bool ResolutionController::addFrameTime(double ms)
+{
+    if(m_average < 0)
+    {
+        m_average = ms;
+    }
+    else
+    {
+        m_average = FRAME_TIME_SMOOTHING*ms + (1 - FRAME_TIME_SMOOTHING)*m_average;
+    }
+
+    if(m_target <= 0 || m_average <= 0)
+    {
+        return false;
+    }
+
+    //Pixel count and therefore cost scale with the square of the render scale
+    double scale = m_scale*sqrt(m_target/m_average);
+    scale = std::max(MIN_RENDER_SCALE, std::min(1.0, scale));
+
+    bool changed = false;
+    if(fabs(scale - m_scale) > RESOLUTION_HYSTERESIS*m_scale || (scale == 1.0 && m_scale != 1.0))
+    {
+        //Predict the average for the new scale instead of waiting for it to settle
+        m_average *= (scale*scale)/(m_scale*m_scale);
+        m_scale = scale;
+        changed = true;
+    }
+
+    //Shadows are the next thing to give up once the resolution cannot go lower
+    if(m_shadows && m_scale == MIN_RENDER_SCALE && m_average > m_target*(1 + RESOLUTION_HYSTERESIS))
+    {
+        m_shadows = false;
+        changed = true;
+    }
+    else if(!m_shadows && m_average < m_target*0.5)
+    {
+        m_shadows = true;
+        changed = true;
+    }
+
+    return changed;
+}
+
+double ResolutionController::getScale()
+{
+    return m_scale;
+}
+
+bool ResolutionController::getShadows()
+{
+    return m_shadows;
+}
+
+double ResolutionController::getAverageFrameTime()
+{
+    return m_average;
+}
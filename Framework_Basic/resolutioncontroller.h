@@ -0,0 +1,54 @@
+//
+// ResolutionController
+//
+// Adapts the internal render resolution to hold a target frame time.
+// The cost of a frame is assumed to be proportional to the number of rendered pixels,
+// i.e. to the square of the render scale. Recent frame times are averaged and the
+// scale is changed only if it is off by more than RESOLUTION_HYSTERESIS, so the
+// resolution does not flicker. If the minimum scale is still too slow, shadow rays
+// are switched off until there is enough headroom again.
+//
+
+#ifndef RESOLUTIONCONTROLLER_H
+#define RESOLUTIONCONTROLLER_H
+
+// Smallest render scale
+#define MIN_RENDER_SCALE 0.25
+
+// Relative scale change needed before the resolution is adapted
+#define RESOLUTION_HYSTERESIS 0.1
+
+// Weight of the newest frame in the frame time average
+#define FRAME_TIME_SMOOTHING 0.3
+
+class ResolutionController
+{
+public:
+    ResolutionController();
+
+    // Target frame time in milliseconds, <= 0 renders at full resolution
+    void setTargetFrameTime(double ms);
+
+    double getTargetFrameTime();
+
+    // Add the duration of the last frame, rendered with the current scale and shadow setting.
+    // Returns true if the scale or the shadow setting changed.
+    bool addFrameTime(double ms);
+
+    // Render scale in [MIN_RENDER_SCALE, 1]
+    double getScale();
+
+    // Shadow rays enabled
+    bool getShadows();
+
+    // Smoothed frame time in milliseconds
+    double getAverageFrameTime();
+
+private:
+    double m_target;
+    double m_average;   // Smoothed frame time, < 0 if there is no frame yet
+    double m_scale;
+    bool m_shadows;
+};
+
+#endif // RESOLUTIONCONTROLLER_H
@@ -0,0 +1,182 @@
+#include "scenegraph.h"
+#include "quaternion.h"
+#include <algorithm>
+
+SceneGraph::SceneGraph()
+{
+    m_updateCount = 0;
+}
+
+void SceneGraph::clear()
+{
+    m_parents.clear();
+    m_children.clear();
+    m_locals.clear();
+    m_worlds.clear();
+    m_dirty.clear();
+    m_dirtyNodes.clear();
+    m_changedNodes.clear();
+    m_stamps.clear();
+    m_orbitNodes.clear();
+    m_orbitAxes.clear();
+    m_orbitOffsets.clear();
+    m_orbitSpeeds.clear();
+    m_orbitAngles.clear();
+}
+
+int SceneGraph::addNode(int parent, Mat4d local)
+{
+    int node = m_parents.size();
+    if(parent >= node)
+    {
+        parent = -1;    //Parents have to exist before their children
+    }
+
+    m_parents.push_back(parent);
+    m_children.push_back(std::vector<int>());
+    if(parent >= 0)
+    {
+        m_children[parent].push_back(node);
+    }
+    m_locals.push_back(local);
+    m_worlds.push_back(local);
+    m_dirty.push_back(0);
+    m_stamps.push_back(-1);
+    markDirty(node);
+    return node;
+}
+
+void SceneGraph::setOrbit(int node, Vec4d axis, Vec4d offset, double speed)
+{
+    m_orbitNodes.push_back(node);
+    m_orbitAxes.push_back(axis);
+    m_orbitOffsets.push_back(offset);
+    m_orbitSpeeds.push_back(speed);
+    m_orbitAngles.push_back(0.0);
+
+    Mat4d transMat;
+    setLocal(node, transMat.makeTransMat(offset));
+}
+
+void SceneGraph::animate(double steps)
+{
+    Mat4d transMat;
+    for(unsigned int i=0; i<m_orbitNodes.size(); i++)
+    {
+        //Resting orbits stay clean, so a static scene has no changed nodes
+        if(m_orbitSpeeds[i] == 0)
+        {
+            continue;
+        }
+
+        //The angle is accumulated and the matrix rebuilt from it, so no error accumulates in the matrices
+        m_orbitAngles[i] = fmod(m_orbitAngles[i] + steps*m_orbitSpeeds[i], 2*M_PI);
+        Quatd rot = Quatd::fromAxisAngle(m_orbitAxes[i], m_orbitAngles[i]);
+        setLocal(m_orbitNodes[i], rot.toMatrix()*transMat.makeTransMat(m_orbitOffsets[i]));
+    }
+}
+
+void SceneGraph::setLocal(int node, Mat4d local)
+{
+    m_locals[node] = local;
+    markDirty(node);
+}
+
+const Mat4d &SceneGraph::getLocal(int node)
+{
+    return m_locals[node];
+}
+
+int SceneGraph::getParent(int node)
+{
+    return m_parents[node];
+}
+
+int SceneGraph::size()
+{
+    return m_parents.size();
+}
+
+void SceneGraph::markDirty(int node)
+{
+    if(!m_dirty[node])
+    {
+        m_dirty[node] = 1;
+        m_dirtyNodes.push_back(node);
+    }
+}
+
+int SceneGraph::update()
+{
+    m_changedNodes.clear();
+    if(m_dirtyNodes.empty())
+    {
+        return 0;
+    }
+
+    m_updateCount++;
+
+    //Ancestors have smaller indices, so their subtrees are recomputed first
+    //and dirty nodes inside an already recomputed subtree are skipped.
+    std::sort(m_dirtyNodes.begin(), m_dirtyNodes.end());
+
+    std::vector<int> stack;
+    for(unsigned int i=0; i<m_dirtyNodes.size(); i++)
+    {
+        int root = m_dirtyNodes[i];
+        m_dirty[root] = 0;
+        if(m_stamps[root] == m_updateCount)
+        {
+            continue;
+        }
+
+        stack.push_back(root);
+        while(!stack.empty())
+        {
+            int node = stack.back();
+            stack.pop_back();
+
+            int parent = m_parents[node];
+            if(parent >= 0)
+            {
+                m_worlds[node] = m_worlds[parent]*m_locals[node];
+            }
+            else
+            {
+                m_worlds[node] = m_locals[node];
+            }
+            m_stamps[node] = m_updateCount;
+            m_changedNodes.push_back(node);
+
+            const std::vector<int> &children = m_children[node];
+            for(int c = children.size()-1; c >= 0; c--)
+            {
+                stack.push_back(children[c]);
+            }
+        }
+    }
+    m_dirtyNodes.clear();
+
+    return m_changedNodes.size();
+}
+
+const Mat4d &SceneGraph::getWorld(int node)
+{
+    return m_worlds[node];
+}
+
+Vec4d SceneGraph::getWorldPosition(int node)
+{
+    const Mat4d &world = m_worlds[node];
+    return Vec4d(world(0,3), world(1,3), world(2,3), 1);
+}
+
+const std::vector<Mat4d> &SceneGraph::getWorldMatrices()
+{
+    return m_worlds;
+}
+
+const std::vector<int> &SceneGraph::getChangedNodes()
+{
+    return m_changedNodes;
+}
@@ -0,0 +1,83 @@
+//
+// SceneGraph
+//
+// Hierarchy of transform nodes. Every node has a local matrix relative to its parent;
+// the world matrices of all nodes are kept in one flat array in node order.
+// Parents are always created before their children, so the node order is a topological
+// order and a single pass computes all world matrices. Only dirty nodes and their
+// subtrees are recomputed by update(), static parts of the scene cost nothing per frame.
+//
+
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+#include <vector>
+#include "vector.h"
+#include "matrix.h"
+
+class SceneGraph
+{
+public:
+    SceneGraph();
+
+    // Remove all nodes
+    void clear();
+
+    // Add a node below parent (-1 for a root node) and return its index.
+    int addNode(int parent, Mat4d local);
+
+    // Let the node orbit the origin of its parent: local = R(angle, axis) * T(offset).
+    // The angle starts at zero and advances by speed per animation step. Axis and offset are
+    // in the frame of the parent, so they turn with the parent's own orbit, not fixed in world space.
+    void setOrbit(int node, Vec4d axis, Vec4d offset, double speed);
+
+    // Advance all orbits by the given number of steps and mark the orbiting nodes dirty.
+    void animate(double steps);
+
+    void setLocal(int node, Mat4d local);
+
+    const Mat4d &getLocal(int node);
+
+    int getParent(int node);
+
+    int size();
+
+    // Recompute the world matrices of all dirty nodes and their subtrees.
+    // Returns the number of recomputed nodes.
+    int update();
+
+    // World matrix of the node, valid after update()
+    const Mat4d &getWorld(int node);
+
+    // Origin of the node in world coordinates
+    Vec4d getWorldPosition(int node);
+
+    // Flat array of all world matrices in node order
+    const std::vector<Mat4d> &getWorldMatrices();
+
+    // Nodes whose world matrices were recomputed by the last update(), parents before their children
+    const std::vector<int> &getChangedNodes();
+
+private:
+    // Mark the node dirty, its subtree is recomputed by the next update()
+    void markDirty(int node);
+
+    std::vector<int> m_parents;
+    std::vector<std::vector<int> > m_children;
+    std::vector<Mat4d> m_locals;
+    std::vector<Mat4d> m_worlds;    // Flat world matrix array
+    std::vector<char> m_dirty;      // Node is in m_dirtyNodes
+    std::vector<int> m_dirtyNodes;  // Roots of the subtrees to recompute
+    std::vector<int> m_changedNodes;
+    std::vector<int> m_stamps;      // Update in which the node was last recomputed
+    int m_updateCount;
+
+    // Orbit animation
+    std::vector<int> m_orbitNodes;
+    std::vector<Vec4d> m_orbitAxes;
+    std::vector<Vec4d> m_orbitOffsets;
+    std::vector<double> m_orbitSpeeds;
+    std::vector<double> m_orbitAngles;
+};
+
+#endif // SCENEGRAPH_H
@@ -0,0 +1,597 @@
+#include "sceneloader.h"
+#include "quaternion.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <QFile>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <algorithm>
+
+// Number of sphere records read from a binary file at once
+#define SPHERE_BLOCK 4096
+
+// Size of the line buffer for text scene files, longer lines are rejected
+#define MAX_LINE 1024
+
+Scene::Scene()
+{
+    hasCamera = false;
+}
+
+void Scene::clear()
+{
+    spheres.clear();
+    sphereMaterials.clear();
+    sphereParents.clear();
+    orbitAxes.clear();
+    orbitSpeeds.clear();
+    materials.clear();
+    lights.clear();
+    meshes.clear();
+    meshColors.clear();
+    models.clear();
+    instances.clear();
+    texture = QString();
+    hasCamera = false;
+}
+
+void Scene::swap(Scene &other)
+{
+    spheres.swap(other.spheres);
+    sphereMaterials.swap(other.sphereMaterials);
+    sphereParents.swap(other.sphereParents);
+    orbitAxes.swap(other.orbitAxes);
+    orbitSpeeds.swap(other.orbitSpeeds);
+    materials.swap(other.materials);
+    lights.swap(other.lights);
+    meshes.swap(other.meshes);
+    meshColors.swap(other.meshColors);
+    models.swap(other.models);
+    instances.swap(other.instances);
+    std::swap(texture, other.texture);
+    std::swap(hasCamera, other.hasCamera);
+    std::swap(camera, other.camera);
+}
+
+size_t Scene::memoryUsage()
+{
+    //Meshes and models own their vertex arrays
+    size_t meshMemory = 0;
+    for(unsigned int i=0; i<meshes.size(); i++)
+    {
+        meshMemory += meshes[i].memoryUsage();
+    }
+    for(unsigned int i=0; i<models.size(); i++)
+    {
+        meshMemory += models[i].memoryUsage();
+    }
+
+    return meshMemory
+            + texture.capacity()*sizeof(QChar)
+            + spheres.capacity()*sizeof(sphere)
+            + sphereMaterials.capacity()*sizeof(int)
+            + sphereParents.capacity()*sizeof(int)
+            + orbitAxes.capacity()*sizeof(Vec4d)
+            + orbitSpeeds.capacity()*sizeof(double)
+            + materials.capacity()*sizeof(Material)
+            + lights.capacity()*sizeof(Light)
+            + meshes.capacity()*sizeof(LineMesh)
+            + meshColors.capacity()*sizeof(Vec3d)
+            + models.capacity()*sizeof(TriangleMesh)
+            + instances.capacity()*sizeof(MeshInstance);
+}
+
+SceneLoader::SceneLoader()
+{
+    m_loadTime = 0;
+}
+
+QString SceneLoader::getError()
+{
+    return m_error;
+}
+
+qint64 SceneLoader::getLoadTime()
+{
+    return m_loadTime;
+}
+
+bool SceneLoader::load(QString filename, Scene &scene)
+{
+    QElapsedTimer timer;
+    timer.start();
+    m_error = QString();
+    scene.clear();
+
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        m_error = "Cannot open " + filename + ": " + file.errorString();
+        return false;
+    }
+
+    char magic[4];
+    bool binary = file.peek(magic, 4) == 4 && memcmp(magic, SCENE_FILE_MAGIC, 4) == 0;
+    bool ok = binary ? loadBinary(file, scene) : loadText(file, scene);
+    if(!ok)
+    {
+        m_error = filename + ": " + m_error;
+        scene.clear();
+        return false;
+    }
+
+    //Texture names are relative to the scene file
+    if(!scene.texture.isEmpty() && QFileInfo(scene.texture).isRelative())
+    {
+        scene.texture = QFileInfo(filename).absolutePath() + "/" + scene.texture;
+    }
+
+    m_loadTime = timer.elapsed();
+    return true;
+}
+
+QString SceneLoader::scenePath(QFile &file, QString filename)
+{
+    if(QFileInfo(filename).isRelative())
+    {
+        return QFileInfo(file.fileName()).absolutePath() + "/" + filename;
+    }
+    return filename;
+}
+
+bool SceneLoader::checkCount(QFile &file, quint64 count, qint64 recordSize, QString what)
+{
+    if(count > quint64(file.size() - file.pos()) / recordSize)
+    {
+        m_error = "truncated " + what;
+        return false;
+    }
+    return true;
+}
+
+bool SceneLoader::addSphere(Scene &scene, int material, Vec4d center, double radius, int parent, Vec4d axis, double speed)
+{
+    if(material < 0 || material >= int(scene.materials.size()))
+    {
+        m_error = QString("undefined material %1").arg(material);
+        return false;
+    }
+    if(parent >= int(scene.spheres.size()))
+    {
+        m_error = QString("parent %1 has to be defined before its children").arg(parent);
+        return false;
+    }
+    //Negated, so NaN fails as well
+    if(!(radius >= 0) || radius == INFINITY)
+    {
+        m_error = QString("radius %1").arg(radius);
+        return false;
+    }
+
+    scene.spheres.push_back(sphere(scene.materials[material], center, radius));
+    scene.sphereMaterials.push_back(material);
+    scene.sphereParents.push_back(parent < 0 ? -1 : parent);
+    scene.orbitAxes.push_back(axis);
+    scene.orbitSpeeds.push_back(speed);
+    return true;
+}
+
+bool SceneLoader::addLight(Scene &scene, Vec3d position, Vec3d color, Vec3d ambient, double radius)
+{
+    if(!(radius >= 0))
+    {
+        m_error = QString("radius %1").arg(radius);
+        return false;
+    }
+
+    scene.lights.push_back(Light(position, color, ambient, radius));
+    return true;
+}
+
+bool SceneLoader::loadText(QFile &file, Scene &scene)
+{
+    char line[MAX_LINE];
+    char keyword[32];
+    int lineNumber = 0;
+
+    qint64 length;
+    while((length = file.readLine(line, MAX_LINE)) > 0)
+    {
+        lineNumber++;
+
+        //readLine() stops at a full buffer, the rest would be read as the next line
+        if(length == MAX_LINE-1 && line[length-1] != '\n' && !file.atEnd())
+        {
+            m_error = QString("line %1: longer than %2 characters").arg(lineNumber).arg(MAX_LINE-2);
+            return false;
+        }
+
+        char *comment = strchr(line, '#');
+        if(comment)
+        {
+            *comment = '\0';
+        }
+        int offset = 0;
+        if(sscanf(line, "%31s%n", keyword, &offset) != 1)
+        {
+            continue;   //Empty line
+        }
+        const char *args = line + offset;
+
+        bool ok = true;
+        if(strcmp(keyword, "sphere") == 0)
+        {
+            int material, parent = -1;
+            double cx, cy, cz, radius, ax = 0, ay = 0, az = 0, speed = 0;
+            int n = sscanf(args, "%d %lf %lf %lf %lf %d %lf %lf %lf %lf",
+                           &material, &cx, &cy, &cz, &radius, &parent, &ax, &ay, &az, &speed);
+            ok = (n == 5 || n == 10) && addSphere(scene, material, Vec4d(cx, cy, cz, 1), radius, parent, Vec4d(ax, ay, az, 0), speed);
+        }
+        else if(strcmp(keyword, "material") == 0)
+        {
+            double d[13];
+            d[10] = 0;
+            d[11] = 0;
+            d[12] = 1;
+            int n = sscanf(args, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf",
+                           &d[0], &d[1], &d[2], &d[3], &d[4], &d[5], &d[6], &d[7], &d[8], &d[9], &d[10], &d[11], &d[12]);
+            ok = n == 10 || n == 11 || n == 13;
+            if(ok)
+            {
+                Material material(Vec3d(d[0], d[1], d[2]), Vec3d(d[3], d[4], d[5]), Vec3d(d[6], d[7], d[8]), d[9]);
+                material.setReflection(d[10]);
+                material.setRefraction(d[11], d[12]);
+                scene.materials.push_back(material);
+            }
+        }
+        else if(strcmp(keyword, "light") == 0)
+        {
+            double d[10];
+            d[9] = INFINITY;
+            int n = sscanf(args, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf",
+                           &d[0], &d[1], &d[2], &d[3], &d[4], &d[5], &d[6], &d[7], &d[8], &d[9]);
+            ok = (n == 9 || n == 10) && addLight(scene, Vec3d(d[0], d[1], d[2]), Vec3d(d[3], d[4], d[5]), Vec3d(d[6], d[7], d[8]), d[9]);
+        }
+        else if(strcmp(keyword, "camera") == 0)
+        {
+            double d[10];
+            ok = sscanf(args, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf",
+                        &d[0], &d[1], &d[2], &d[3], &d[4], &d[5], &d[6], &d[7], &d[8], &d[9]) == 10;
+            if(ok)
+            {
+                scene.camera.setEyePoint(Vec4d(d[0], d[1], d[2], 0));
+                scene.camera.setViewVec(Vec4d(d[3], d[4], d[5], 0));
+                scene.camera.setUpVec(Vec4d(d[6], d[7], d[8], 0));
+                scene.camera.setFocus(d[9]);
+                scene.hasCamera = true;
+            }
+        }
+        else if(strcmp(keyword, "mesh") == 0)
+        {
+            char name[MAX_LINE];
+            double r = 0, g = 0, b = 0;
+            int n = sscanf(args, "%1023s %lf %lf %lf", name, &r, &g, &b);
+            ok = n == 1 || n == 4;
+            if(ok)
+            {
+                scene.meshes.push_back(LineMesh());
+                ok = scene.meshes.back().loadObj(scenePath(file, QString::fromLocal8Bit(name)));
+                if(ok)
+                {
+                    scene.meshColors.push_back(Vec3d(r, g, b));
+                }
+                else
+                {
+                    m_error = scene.meshes.back().getError();
+                }
+            }
+        }
+        else if(strcmp(keyword, "model") == 0)
+        {
+            char name[MAX_LINE];
+            ok = sscanf(args, "%1023s", name) == 1;
+            if(ok)
+            {
+                scene.models.push_back(TriangleMesh());
+                ok = scene.models.back().loadObj(scenePath(file, QString::fromLocal8Bit(name)));
+                if(!ok)
+                {
+                    m_error = scene.models.back().getError();
+                }
+            }
+        }
+        else if(strcmp(keyword, "instance") == 0)
+        {
+            int model, material;
+            double tx, ty, tz, scale = 1, ax = 0, ay = 0, az = 1, angle = 0;
+            int n = sscanf(args, "%d %d %lf %lf %lf %lf %lf %lf %lf %lf",
+                           &model, &material, &tx, &ty, &tz, &scale, &ax, &ay, &az, &angle);
+            ok = n == 5 || n == 6 || n == 10;
+            if(ok && (model < 0 || model >= int(scene.models.size())))
+            {
+                m_error = QString("undefined model %1").arg(model);
+                ok = false;
+            }
+            if(ok && (material < 0 || material >= int(scene.materials.size())))
+            {
+                m_error = QString("undefined material %1").arg(material);
+                ok = false;
+            }
+            if(ok && ax == 0 && ay == 0 && az == 0 && angle != 0)
+            {
+                m_error = QString("rotation axis (0, 0, 0)");
+                ok = false;
+            }
+            if(ok)
+            {
+                Mat4d transMat, scaleMat;
+                scaleMat(0,0) = scale;
+                scaleMat(1,1) = scale;
+                scaleMat(2,2) = scale;
+                scaleMat(3,3) = 1;
+                Mat4d transform = transMat.makeTransMat(Vec4d(tx, ty, tz, 1))
+                        * Quatd::fromAxisAngle(Vec4d(ax, ay, az, 0), angle).toMatrix() * scaleMat;
+                MeshInstance instance(model, transform, scene.materials[material]);
+                ok = instance.getMesh() >= 0;
+                if(ok)
+                {
+                    instance.updateBounds(scene.models[model]);
+                    scene.instances.push_back(instance);
+                }
+                else
+                {
+                    m_error = QString("transform, it is singular or not finite");
+                }
+            }
+        }
+        else if(strcmp(keyword, "texture") == 0)
+        {
+            scene.texture = QString(args).trimmed();
+            ok = !scene.texture.isEmpty();
+        }
+        else
+        {
+            m_error = QString("unknown keyword");
+            ok = false;
+        }
+
+        if(!ok)
+        {
+            m_error = QString("line %1: invalid %2 %3").arg(lineNumber).arg(QString(keyword)).arg(m_error);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SceneLoader::loadBinary(QFile &file, Scene &scene)
+{
+    SceneFileHeader header;
+    if(file.read((char*)&header, sizeof(header)) != sizeof(header) || header.version < 1 || header.version > 2)
+    {
+        m_error = "invalid header";
+        return false;
+    }
+
+    //The counts come from the file, a corrupt header must not make the loader allocate for them
+    if(!checkCount(file, header.textureLength, 1, "texture name"))
+    {
+        return false;
+    }
+    if(header.textureLength > 0)
+    {
+        std::vector<char> texture(header.textureLength);
+        if(file.read(&texture[0], header.textureLength) != header.textureLength)
+        {
+            m_error = "truncated texture name";
+            return false;
+        }
+        scene.texture = QString::fromUtf8(&texture[0], header.textureLength);
+    }
+
+    if(header.hasCamera)
+    {
+        SceneFileCamera cam;
+        if(file.read((char*)&cam, sizeof(cam)) != sizeof(cam))
+        {
+            m_error = "truncated camera";
+            return false;
+        }
+        scene.camera.setEyePoint(Vec4d(cam.eye[0], cam.eye[1], cam.eye[2], 0));
+        scene.camera.setViewVec(Vec4d(cam.view[0], cam.view[1], cam.view[2], 0));
+        scene.camera.setUpVec(Vec4d(cam.up[0], cam.up[1], cam.up[2], 0));
+        scene.camera.setFocus(cam.focus);
+        scene.hasCamera = true;
+    }
+
+    //Version 1 materials have neither reflection nor refraction and lights have no radius
+    qint64 materialSize = header.version == 1 ? offsetof(SceneFileMaterial, reflection) : sizeof(SceneFileMaterial);
+    qint64 lightSize = header.version == 1 ? offsetof(SceneFileLight, radius) : sizeof(SceneFileLight);
+    if(!checkCount(file, header.materialCount, materialSize, "materials"))
+    {
+        return false;
+    }
+    scene.materials.reserve(header.materialCount);
+    for(quint32 i=0; i<header.materialCount; i++)
+    {
+        SceneFileMaterial mat;
+        mat.reflection = 0;
+        mat.transparency = 0;
+        mat.refractiveIndex = 1;
+        if(file.read((char*)&mat, materialSize) != materialSize)
+        {
+            m_error = "truncated materials";
+            return false;
+        }
+        Material material(Vec3d(mat.diffuse), Vec3d(mat.specular), Vec3d(mat.ambient), mat.shininess);
+        material.setReflection(mat.reflection);
+        material.setRefraction(mat.transparency, mat.refractiveIndex);
+        scene.materials.push_back(material);
+    }
+
+    if(!checkCount(file, header.lightCount, lightSize, "lights"))
+    {
+        return false;
+    }
+    scene.lights.reserve(header.lightCount);
+    for(quint32 i=0; i<header.lightCount; i++)
+    {
+        SceneFileLight light;
+        light.radius = INFINITY;
+        if(file.read((char*)&light, lightSize) != lightSize)
+        {
+            m_error = "truncated lights";
+            return false;
+        }
+        if(!addLight(scene, Vec3d(light.position), Vec3d(light.color), Vec3d(light.ambient), light.radius))
+        {
+            m_error = QString("light %1: %2").arg(int(scene.lights.size())).arg(m_error);
+            return false;
+        }
+    }
+
+    //Allocate all arrays once, then stream the sphere records through a fixed block buffer
+    if(!checkCount(file, header.sphereCount, sizeof(SceneFileSphere), "spheres"))
+    {
+        return false;
+    }
+    scene.spheres.reserve(header.sphereCount);
+    scene.sphereMaterials.reserve(header.sphereCount);
+    scene.sphereParents.reserve(header.sphereCount);
+    scene.orbitAxes.reserve(header.sphereCount);
+    scene.orbitSpeeds.reserve(header.sphereCount);
+
+    std::vector<SceneFileSphere> block(SPHERE_BLOCK);
+    quint32 remaining = header.sphereCount;
+    while(remaining > 0)
+    {
+        quint32 count = remaining < SPHERE_BLOCK ? remaining : SPHERE_BLOCK;
+        qint64 bytes = count*sizeof(SceneFileSphere);
+        if(file.read((char*)&block[0], bytes) != bytes)
+        {
+            m_error = "truncated spheres";
+            return false;
+        }
+        for(quint32 i=0; i<count; i++)
+        {
+            const SceneFileSphere &rec = block[i];
+            if(!addSphere(scene, rec.material, Vec4d(rec.center[0], rec.center[1], rec.center[2], 1), rec.radius,
+                          rec.parent, Vec4d(rec.axis[0], rec.axis[1], rec.axis[2], 0), rec.speed))
+            {
+                m_error = QString("sphere %1: %2").arg(int(scene.spheres.size())).arg(m_error);
+                return false;
+            }
+        }
+        remaining -= count;
+    }
+
+    //Records of another size than the version says would have left bytes over
+    if(file.pos() != file.size())
+    {
+        m_error = "unexpected data after the spheres";
+        return false;
+    }
+    return true;
+}
+
+bool SceneLoader::saveBinary(QString filename, Scene &scene)
+{
+    //The binary format has no records for these, converting would silently drop them
+    if(!scene.meshes.empty() || !scene.models.empty() || !scene.instances.empty())
+    {
+        m_error = "Meshes, models and instances cannot be saved in the binary format";
+        return false;
+    }
+
+    QFile file(filename);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        m_error = "Cannot open " + filename + ": " + file.errorString();
+        return false;
+    }
+
+    QByteArray texture = scene.texture.toUtf8();
+
+    SceneFileHeader header;
+    memcpy(header.magic, SCENE_FILE_MAGIC, 4);
+    header.version = 2;
+    header.materialCount = scene.materials.size();
+    header.lightCount = scene.lights.size();
+    header.sphereCount = scene.spheres.size();
+    header.hasCamera = scene.hasCamera;
+    header.textureLength = texture.size();
+    file.write((const char*)&header, sizeof(header));
+    file.write(texture.constData(), texture.size());
+
+    if(scene.hasCamera)
+    {
+        SceneFileCamera cam;
+        Vec4d eye = scene.camera.getEyePoint();
+        Vec4d view = scene.camera.getViewVec();
+        Vec4d up = scene.camera.getUpVec();
+        for(int i=0; i<3; i++)
+        {
+            cam.eye[i] = eye(i);
+            cam.view[i] = view(i);
+            cam.up[i] = up(i);
+        }
+        cam.focus = scene.camera.getFocus();
+        file.write((const char*)&cam, sizeof(cam));
+    }
+
+    for(unsigned int i=0; i<scene.materials.size(); i++)
+    {
+        Material &material = scene.materials[i];
+        SceneFileMaterial mat;
+        material.getDiffuse().getData(mat.diffuse);
+        material.getSpecular().getData(mat.specular);
+        material.getAmbient().getData(mat.ambient);
+        mat.shininess = material.getShininess();
+        mat.reflection = material.getReflection();
+        mat.transparency = material.getTransparency();
+        mat.refractiveIndex = material.getRefractiveIndex();
+        file.write((const char*)&mat, sizeof(mat));
+    }
+
+    for(unsigned int i=0; i<scene.lights.size(); i++)
+    {
+        SceneFileLight light;
+        scene.lights[i].getPosition().getData(light.position);
+        scene.lights[i].getLightColor().getData(light.color);
+        scene.lights[i].getAmbient().getData(light.ambient);
+        light.radius = scene.lights[i].getRadius();
+        file.write((const char*)&light, sizeof(light));
+    }
+
+    std::vector<SceneFileSphere> block;
+    block.reserve(SPHERE_BLOCK);
+    for(unsigned int i=0; i<scene.spheres.size(); i++)
+    {
+        SceneFileSphere rec;
+        Vec4d center = scene.spheres[i].getCenter();
+        for(int j=0; j<3; j++)
+        {
+            rec.center[j] = center(j);
+            rec.axis[j] = scene.orbitAxes[i](j);
+        }
+        rec.radius = scene.spheres[i].getRadius();
+        rec.speed = scene.orbitSpeeds[i];
+        rec.material = scene.sphereMaterials[i];
+        rec.parent = scene.sphereParents[i];
+        block.push_back(rec);
+
+        if(block.size() == SPHERE_BLOCK || i+1 == scene.spheres.size())
+        {
+            file.write((const char*)&block[0], block.size()*sizeof(SceneFileSphere));
+            block.clear();
+        }
+    }
+
+    if(file.error() != QFile::NoError)
+    {
+        m_error = "Cannot write " + filename + ": " + file.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,173 @@
+//
+// SceneLoader
+//
+// Loads scenes from scene files instead of hard-coding them in GLBox.
+//
+// Text format (.scn), one entry per line, '#' starts a comment:
+//   camera   ex ey ez  vx vy vz  ux uy uz  focus
+//   texture  filename                       (relative to the scene file)
+//   material dr dg db  sr sg sb  ar ag ab  shininess  [reflection  [transparency  index]]
+//   light    px py pz  r g b  ar ag ab  [radius]
+//   sphere   material  cx cy cz  radius  [parent  ax ay az  speed]
+//   mesh     filename  [r g b]              (OBJ wireframe, relative to the scene file)
+//   model    filename                       (OBJ triangle mesh, relative to the scene file)
+//   instance model  material  tx ty tz  [scale  [ax ay az  angle]]
+// Materials and models are referenced by their index in order of declaration, parents by
+// the index of an earlier sphere. An instance places a model scaled, rotated by angle
+// radians around the axis (ax, ay, az) and moved to (tx, ty, tz); models are stored once.
+// A sphere with a parent orbits it around the axis (ax, ay, az) by speed radians per
+// animation step; the axis is in the frame of the parent and turns with the parent's orbit.
+// Lights without radius are unbounded. Reflection and transparency are the shares (0-1) of
+// the mirrored and refracted color, index the index of refraction.
+//
+// Binary format (.scb, native byte order) for huge scenes: a SceneFileHeader, the texture
+// name, the camera, then arrays of SceneFileMaterial, SceneFileLight and SceneFileSphere
+// records. Spheres are read in blocks directly into the preallocated sphere array. Meshes,
+// models and instances are only supported by the text format, saving them fails.
+// The magic is the same for all versions, the layout is chosen by the version alone: version 1
+// materials end after shininess and version 1 lights have no radius. Files with data after
+// the spheres are rejected, so a record size mismatch cannot go unnoticed.
+//
+
+#ifndef SCENELOADER_H
+#define SCENELOADER_H
+
+#include <vector>
+#include <QString>
+#include <QFile>
+#include "vector.h"
+#include "sphere.h"
+#include "material.h"
+#include "light.h"
+#include "camera.h"
+#include "linemesh.h"
+#include "trianglemesh.h"
+
+// Scene description as read from a scene file. All objects are stored by value in contiguous arrays.
+class Scene
+{
+public:
+    Scene();
+
+    void clear();
+
+    // Exchange the content with another scene without copying
+    void swap(Scene &other);
+
+    // Approximate memory used by the scene arrays and the meshes and models in them in bytes
+    size_t memoryUsage();
+
+    std::vector<sphere> spheres;
+    std::vector<int> sphereMaterials;   // Material index of each sphere
+    std::vector<int> sphereParents;     // Parent sphere of each sphere, -1 if none
+    std::vector<Vec4d> orbitAxes;       // Orbit axis of each sphere with a parent
+    std::vector<double> orbitSpeeds;    // Orbit speed of each sphere with a parent
+
+    std::vector<Material> materials;
+    std::vector<Light> lights;
+
+    std::vector<LineMesh> meshes;
+    std::vector<Vec3d> meshColors;      // Line color of each mesh
+
+    std::vector<TriangleMesh> models;
+    std::vector<MeshInstance> instances;
+
+    QString texture;    // Texture file name, empty if none
+
+    bool hasCamera;
+    Camera camera;
+};
+
+// First bytes of every binary scene file, independent of the format version
+#define SCENE_FILE_MAGIC "SCB1"
+
+// Binary file layout
+struct SceneFileHeader
+{
+    char magic[4];          // SCENE_FILE_MAGIC
+    quint32 version;        // 2, see above for version 1
+    quint32 materialCount;
+    quint32 lightCount;
+    quint32 sphereCount;
+    quint32 hasCamera;
+    quint32 textureLength;  // Length of the texture name following the header
+};
+
+struct SceneFileCamera
+{
+    double eye[3];
+    double view[3];
+    double up[3];
+    double focus;
+};
+
+struct SceneFileMaterial
+{
+    double diffuse[3];
+    double specular[3];
+    double ambient[3];
+    double shininess;
+    double reflection;
+    double transparency;
+    double refractiveIndex;
+};
+
+struct SceneFileLight
+{
+    double position[3];
+    double color[3];
+    double ambient[3];
+    double radius;          // INFINITY for unbounded lights
+};
+
+struct SceneFileSphere
+{
+    double center[3];
+    double radius;
+    double axis[3];
+    double speed;
+    qint32 material;
+    qint32 parent;
+};
+
+class SceneLoader
+{
+public:
+    SceneLoader();
+
+    // Load a text or binary scene file, depending on its content.
+    // Returns false on error, see getError().
+    bool load(QString filename, Scene &scene);
+
+    // Write the scene in the binary format. Returns false on error, also if the scene
+    // has meshes, models or instances.
+    bool saveBinary(QString filename, Scene &scene);
+
+    QString getError();
+
+    // Duration of the last load in milliseconds
+    qint64 getLoadTime();
+
+private:
+    bool loadText(QFile &file, Scene &scene);
+
+    bool loadBinary(QFile &file, Scene &scene);
+
+    // Resolve a file name relative to the scene file
+    QString scenePath(QFile &file, QString filename);
+
+    // Check that count records of recordSize bytes fit into the rest of the file, before
+    // anything is allocated for them. Sets the error "truncated <what>" if they do not.
+    bool checkCount(QFile &file, quint64 count, qint64 recordSize, QString what);
+
+    // Append a sphere and check its references and radius
+    bool addSphere(Scene &scene, int material, Vec4d center, double radius, int parent, Vec4d axis, double speed);
+
+    // Append a light and check its radius, INFINITY for unbounded lights
+    bool addLight(Scene &scene, Vec3d position, Vec3d color, Vec3d ambient, double radius);
+
+    QString m_error;
+    qint64 m_loadTime;
+};
+
+#endif // SCENELOADER_H
@@ -10,17 +10,6 @@ sphere::sphere(Color color, Vec4d center, double radius)
     m_color = color;
     m_center = center;
     m_radius = radius;
-
-        for(int i=-180; i<=180; i++)
-        {
-            for(int j=0; j<=180; j++)
-            {
-                double x = m_radius * sin(j) * cos(i);
-                double y = m_radius * sin(j) * sin(i);
-                double z = m_radius * cos(j);
-                points.append(Vec4d(x, y, z, 1));
-            }
-        }
 }
 
 sphere::sphere(Material material, Vec4d center, double radius)
@@ -68,6 +57,28 @@ Vec3d sphere::intersect(Vec3d eye, Vec3d view)
     return Vec3d(0,0,-INFINITY);
 }
 
+double sphere::intersectDistance(Vec3d origin, Vec3d dir, double tMin)
+{
+    Vec3d offset = origin - getCenter3();
+    double a = dir * dir;
+    double b = dir * offset * 2;
+    double c = offset * offset - m_radius * m_radius;
+
+    double det = b*b - 4*a*c;
+    if(det < 0)
+    {
+        return INFINITY;
+    }
+    double root = sqrt(det);
+    double t1 = (-b - root) / (2*a);
+    double t2 = (-b + root) / (2*a);
+    if(t1 > tMin)
+    {
+        return t1;
+    }
+    return t2 > tMin ? t2 : INFINITY;
+}
+
 
 Vec4d sphere::getCenter()
 {
@@ -88,6 +99,11 @@ void sphere::setCenter(Vec4d center)
     m_center = center;
 }
 
+double sphere::getRadius()
+{
+    return m_radius;
+}
+
 Color sphere::getColor()
 {
     return m_color;
@@ -4,7 +4,6 @@
 #include "Color.h"
 #include "material.h"
 #include "vector.h"
-#include "QList"
 
 class sphere
 {
@@ -17,18 +16,21 @@ public:
 
     Vec3d intersect(Vec3d eye, Vec3d view);
 
+    // Distance t of the first hit of origin + t*dir with t > tMin, INFINITY if none
+    double intersectDistance(Vec3d origin, Vec3d dir, double tMin);
+
     Vec4d getCenter();
 
     Vec3d getCenter3();
 
     void setCenter(Vec4d center);
 
+    double getRadius();
+
     Color getColor();
 
     Material getMaterial();
 
-    QList<Vec4d> points;
-
 private:
     Color m_color;
     Material m_material;
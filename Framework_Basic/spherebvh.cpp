@@ -0,0 +1,485 @@
+#include "spherebvh.h"
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+// Entries of the traversal stack. A traversal holds at most one entry per level of the tree,
+// the median split keeps the depth at about log2 of the sphere count.
+#define SPHERE_BVH_STACK_SIZE 64
+
+// Orders spheres by the center coordinate along one axis
+class CenterLess
+{
+public:
+    CenterLess(const std::vector<Vec4d> &bounds, int axis) : m_bounds(bounds), m_axis(axis) {}
+
+    bool operator ()(int a, int b) const
+    {
+        return m_bounds[a](m_axis) < m_bounds[b](m_axis);
+    }
+
+private:
+    const std::vector<Vec4d> &m_bounds;
+    int m_axis;
+};
+
+// Store the box in the node, rounded outwards so the float box never cuts off a sphere
+static void setBox(SphereNode &node, const double boundsMin[3], const double boundsMax[3])
+{
+    for(int a=0; a<3; a++)
+    {
+        node.boundsMin[a] = nextafterf(float(boundsMin[a]), -FLT_MAX);
+        node.boundsMax[a] = nextafterf(float(boundsMax[a]), FLT_MAX);
+    }
+}
+
+SphereBvh::SphereBvh()
+{
+    m_innerArea = 0;
+    m_builtCost = 0;
+    m_depth = 0;
+}
+
+void SphereBvh::clear()
+{
+    m_nodes.clear();
+    m_parents.clear();
+    m_order.clear();
+    m_leaves.clear();
+    m_marked.clear();
+    m_innerArea = 0;
+    m_builtCost = 0;
+    m_depth = 0;
+}
+
+void SphereBvh::build(std::vector<sphere> &spheres)
+{
+    std::vector<Vec4d> bounds(spheres.size());
+    for(unsigned int i=0; i<spheres.size(); i++)
+    {
+        bounds[i] = spheres[i].getCenter();
+        bounds[i](3) = spheres[i].getRadius();
+    }
+    build(bounds);
+}
+
+void SphereBvh::build(const std::vector<Vec4d> &bounds)
+{
+    clear();
+    int count = bounds.size();
+    if(count == 0)
+    {
+        return;
+    }
+
+    m_order.resize(count);
+    for(int i=0; i<count; i++)
+    {
+        m_order[i] = i;
+    }
+    m_leaves.resize(count);
+    m_nodes.reserve(2*(count / SPHERE_BVH_LEAF_SIZE + 1));
+    m_parents.reserve(m_nodes.capacity());
+    buildNode(bounds, 0, count, -1, 1);
+    m_marked.assign(m_nodes.size(), 0);
+
+    for(unsigned int i=0; i<m_nodes.size(); i++)
+    {
+        if(m_nodes[i].count == 0)
+        {
+            m_innerArea += area(m_nodes[i]);
+        }
+    }
+    double rootArea = area(m_nodes[0]);
+    m_builtCost = rootArea > 0 ? m_innerArea / rootArea : 0;
+}
+
+int SphereBvh::buildNode(const std::vector<Vec4d> &bounds, int first, int count, int parent, int depth)
+{
+    int node = m_nodes.size();
+    m_depth = std::max(m_depth, depth);
+    m_nodes.push_back(SphereNode());
+    m_parents.push_back(parent);
+
+    double boundsMin[3] = { INFINITY, INFINITY, INFINITY };
+    double boundsMax[3] = { -INFINITY, -INFINITY, -INFINITY };
+    double centerMin[3] = { INFINITY, INFINITY, INFINITY };
+    double centerMax[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for(int i=first; i<first + count; i++)
+    {
+        const Vec4d &b = bounds[m_order[i]];
+        for(int a=0; a<3; a++)
+        {
+            boundsMin[a] = std::min(boundsMin[a], b(a) - b(3));
+            boundsMax[a] = std::max(boundsMax[a], b(a) + b(3));
+            centerMin[a] = std::min(centerMin[a], b(a));
+            centerMax[a] = std::max(centerMax[a], b(a));
+        }
+    }
+    setBox(m_nodes[node], boundsMin, boundsMax);
+
+    if(count <= SPHERE_BVH_LEAF_SIZE)
+    {
+        m_nodes[node].index = first;
+        m_nodes[node].count = count;
+        for(int i=first; i<first + count; i++)
+        {
+            m_leaves[m_order[i]] = node;
+        }
+        return node;
+    }
+
+    //Median split along the longest axis of the centers
+    int axis = 0;
+    for(int a=1; a<3; a++)
+    {
+        if(centerMax[a] - centerMin[a] > centerMax[axis] - centerMin[axis])
+        {
+            axis = a;
+        }
+    }
+    int half = count / 2;
+    std::nth_element(m_order.begin() + first, m_order.begin() + first + half, m_order.begin() + first + count,
+                     CenterLess(bounds, axis));
+
+    buildNode(bounds, first, half, node, depth + 1);
+    int right = buildNode(bounds, first + half, count - half, node, depth + 1);
+    m_nodes[node].index = right;
+    m_nodes[node].count = 0;
+    return node;
+}
+
+int SphereBvh::getSphereCount()
+{
+    return m_leaves.size();
+}
+
+void SphereBvh::refit(std::vector<sphere> &spheres, const std::vector<int> &moved)
+{
+    //Mark the path to the root, it ends at the first node marked by another sphere
+    for(unsigned int i=0; i<moved.size(); i++)
+    {
+        int node = m_leaves[moved[i]];
+        while(node >= 0 && !m_marked[node])
+        {
+            m_marked[node] = 1;
+            node = m_parents[node];
+        }
+    }
+    refitMarked(spheres);
+}
+
+void SphereBvh::refit(std::vector<sphere> &spheres)
+{
+    m_marked.assign(m_nodes.size(), 1);
+    refitMarked(spheres);
+}
+
+void SphereBvh::fitLeaf(SphereNode &node, std::vector<sphere> &spheres)
+{
+    double boundsMin[3] = { INFINITY, INFINITY, INFINITY };
+    double boundsMax[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for(int i=node.index; i<node.index + node.count; i++)
+    {
+        sphere &sph = spheres[m_order[i]];
+        Vec4d center = sph.getCenter();
+        double radius = sph.getRadius();
+        for(int a=0; a<3; a++)
+        {
+            boundsMin[a] = std::min(boundsMin[a], center(a) - radius);
+            boundsMax[a] = std::max(boundsMax[a], center(a) + radius);
+        }
+    }
+    setBox(node, boundsMin, boundsMax);
+}
+
+void SphereBvh::refitMarked(std::vector<sphere> &spheres)
+{
+    //Children follow their parent, so going backwards visits the children first
+    for(int n = m_nodes.size()-1; n >= 0; n--)
+    {
+        if(!m_marked[n])
+        {
+            continue;
+        }
+        m_marked[n] = 0;
+
+        SphereNode &node = m_nodes[n];
+        if(node.count > 0)
+        {
+            fitLeaf(node, spheres);
+            continue;
+        }
+
+        const SphereNode &left = m_nodes[n+1];
+        const SphereNode &right = m_nodes[node.index];
+        double oldArea = area(node);
+        for(int a=0; a<3; a++)
+        {
+            node.boundsMin[a] = std::min(left.boundsMin[a], right.boundsMin[a]);
+            node.boundsMax[a] = std::max(left.boundsMax[a], right.boundsMax[a]);
+        }
+        m_innerArea += area(node) - oldArea;
+    }
+}
+
+double SphereBvh::area(const SphereNode &node)
+{
+    double x = node.boundsMax[0] - node.boundsMin[0];
+    double y = node.boundsMax[1] - node.boundsMin[1];
+    double z = node.boundsMax[2] - node.boundsMin[2];
+    return 2*(x*y + y*z + z*x);
+}
+
+double SphereBvh::getDegradation()
+{
+    if(m_nodes.empty() || m_builtCost <= 0)
+    {
+        return 1;
+    }
+    double rootArea = area(m_nodes[0]);
+    return rootArea > 0 ? m_innerArea / rootArea / m_builtCost : 1;
+}
+
+// Entry distance of the ray into the box, INFINITY if it misses it between tMin and tMax
+static inline float intersectBox(const SphereNode &node, const float origin[3], const float invDir[3], float tMin, float tMax)
+{
+    for(int a=0; a<3; a++)
+    {
+        float t0 = (node.boundsMin[a] - origin[a]) * invDir[a];
+        float t1 = (node.boundsMax[a] - origin[a]) * invDir[a];
+        tMin = std::max(tMin, std::min(t0, t1));
+        tMax = std::min(tMax, std::max(t0, t1));
+    }
+    return tMin <= tMax ? tMin : INFINITY;
+}
+
+// Does the ray enter the box at some t > 0?
+static inline bool hitsBox(const SphereNode &node, const float origin[3], const float invDir[3])
+{
+    return intersectBox(node, origin, invDir, 0, INFINITY) != INFINITY;
+}
+
+bool SphereBvh::occluded(const Vec3d &origin, const Vec3d &dir, int exclude, std::vector<sphere> &spheres, qint64 &tests)
+{
+    if(m_nodes.empty())
+    {
+        return false;
+    }
+    if(m_depth > SPHERE_BVH_STACK_SIZE)
+    {
+        return occludedAll(origin, dir, exclude, spheres, tests);
+    }
+
+    float o[3], invDir[3];
+    for(int a=0; a<3; a++)
+    {
+        o[a] = float(origin(a));
+        invDir[a] = 1.0f / float(dir(a));
+    }
+
+    int stack[SPHERE_BVH_STACK_SIZE];
+    int stackSize = 0;
+    if(hitsBox(m_nodes[0], o, invDir))
+    {
+        stack[stackSize++] = 0;
+    }
+
+    while(stackSize > 0)
+    {
+        int n = stack[--stackSize];
+        const SphereNode &node = m_nodes[n];
+        if(node.count == 0)
+        {
+            //Any hit ends the traversal, so the order of the children does not matter
+            if(hitsBox(m_nodes[node.index], o, invDir))
+            {
+                stack[stackSize++] = node.index;
+            }
+            if(hitsBox(m_nodes[n+1], o, invDir))
+            {
+                stack[stackSize++] = n+1;
+            }
+            continue;
+        }
+
+        for(int i=node.index; i<node.index + node.count; i++)
+        {
+            int sph = m_order[i];
+            if(sph == exclude)
+            {
+                continue;
+            }
+            tests++;
+            if(spheres[sph].intersect(origin, dir)(2) != -INFINITY)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+int SphereBvh::intersect(const Vec3d &origin, const Vec3d &dir, double tMin, double &tMax, std::vector<sphere> &spheres, qint64 &tests)
+{
+    if(m_nodes.empty())
+    {
+        return -1;
+    }
+    if(m_depth > SPHERE_BVH_STACK_SIZE)
+    {
+        return intersectAll(origin, dir, tMin, tMax, spheres, tests);
+    }
+
+    float o[3], invDir[3];
+    for(int a=0; a<3; a++)
+    {
+        o[a] = float(origin(a));
+        invDir[a] = 1.0f / float(dir(a));
+    }
+    float nearT = float(tMin);
+    int hitSphere = -1;
+
+    //The boxes are tested up to a bit beyond tMax, float rounding must not cut off the closest hit
+    int stack[SPHERE_BVH_STACK_SIZE];
+    int stackSize = 0;
+    if(intersectBox(m_nodes[0], o, invDir, nearT, nextafterf(float(tMax), FLT_MAX)) != INFINITY)
+    {
+        stack[stackSize++] = 0;
+    }
+
+    while(stackSize > 0)
+    {
+        int n = stack[--stackSize];
+        const SphereNode &node = m_nodes[n];
+        float farT = nextafterf(float(tMax), FLT_MAX);
+        if(node.count == 0)
+        {
+            //The nearer child is visited first, children behind the closest hit are skipped
+            int left = n+1;
+            int right = node.index;
+            float tLeft = intersectBox(m_nodes[left], o, invDir, nearT, farT);
+            float tRight = intersectBox(m_nodes[right], o, invDir, nearT, farT);
+            if(tLeft > tRight)
+            {
+                std::swap(left, right);
+                std::swap(tLeft, tRight);
+            }
+            if(tRight != INFINITY)
+            {
+                stack[stackSize++] = right;
+            }
+            if(tLeft != INFINITY)
+            {
+                stack[stackSize++] = left;
+            }
+            continue;
+        }
+
+        for(int i=node.index; i<node.index + node.count; i++)
+        {
+            int sph = m_order[i];
+            tests++;
+            double t = spheres[sph].intersectDistance(origin, dir, tMin);
+            if(t < tMax)
+            {
+                tMax = t;
+                hitSphere = sph;
+            }
+        }
+    }
+    return hitSphere;
+}
+
+bool SphereBvh::occludedAll(const Vec3d &origin, const Vec3d &dir, int exclude, std::vector<sphere> &spheres, qint64 &tests)
+{
+    for(unsigned int i=0; i<m_order.size(); i++)
+    {
+        int sph = m_order[i];
+        if(sph == exclude)
+        {
+            continue;
+        }
+        tests++;
+        if(spheres[sph].intersect(origin, dir)(2) != -INFINITY)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int SphereBvh::intersectAll(const Vec3d &origin, const Vec3d &dir, double tMin, double &tMax, std::vector<sphere> &spheres, qint64 &tests)
+{
+    int hitSphere = -1;
+    for(unsigned int i=0; i<m_order.size(); i++)
+    {
+        int sph = m_order[i];
+        tests++;
+        double t = spheres[sph].intersectDistance(origin, dir, tMin);
+        if(t < tMax)
+        {
+            tMax = t;
+            hitSphere = sph;
+        }
+    }
+    return hitSphere;
+}
+
+void SphereBvh::swap(SphereBvh &bvh)
+{
+    m_nodes.swap(bvh.m_nodes);
+    m_parents.swap(bvh.m_parents);
+    m_order.swap(bvh.m_order);
+    m_leaves.swap(bvh.m_leaves);
+    m_marked.swap(bvh.m_marked);
+    std::swap(m_innerArea, bvh.m_innerArea);
+    std::swap(m_builtCost, bvh.m_builtCost);
+    std::swap(m_depth, bvh.m_depth);
+}
+
+SphereBvhBuilder::SphereBvhBuilder()
+{
+    //The builder is reused for every rebuild
+    setAutoDelete(false);
+    m_state = IDLE;
+}
+
+void SphereBvhBuilder::prepare(std::vector<sphere> &spheres)
+{
+    m_bounds.resize(spheres.size());
+    for(unsigned int i=0; i<spheres.size(); i++)
+    {
+        m_bounds[i] = spheres[i].getCenter();
+        m_bounds[i](3) = spheres[i].getRadius();
+    }
+    m_state.fetchAndStoreOrdered(RUNNING);
+}
+
+void SphereBvhBuilder::run()
+{
+    m_bvh.build(m_bounds);
+    m_state.fetchAndStoreRelease(FINISHED);
+}
+
+bool SphereBvhBuilder::isRunning()
+{
+    return int(m_state) == RUNNING;
+}
+
+bool SphereBvhBuilder::takeResult(SphereBvh &bvh)
+{
+    if(!m_state.testAndSetOrdered(FINISHED, IDLE))
+    {
+        return false;
+    }
+    bvh.swap(m_bvh);
+    m_bvh.clear();
+    return true;
+}
+
+void SphereBvhBuilder::discard()
+{
+    m_state = IDLE;
+    m_bvh.clear();
+}
@@ -0,0 +1,126 @@
+//
+// SphereBvh
+//
+// Bounding volume hierarchy over the spheres of the scene, used for shadow and secondary rays.
+// Animated spheres move every frame, so the hierarchy is not rebuilt but refit: the boxes of
+// the leaves of moved spheres and of their ancestors are recomputed in place, keeping the tree.
+//
+// A refit tree gets worse as the spheres drift away from where it was built. getDegradation()
+// compares the summed surface area of the inner boxes, relative to the root box, with the
+// value right after the build. Past SPHERE_BVH_REBUILD_RATIO GLBox builds a new tree with
+// SphereBvhBuilder on another thread and keeps refitting the old one until it is done.
+//
+
+#ifndef SPHEREBVH_H
+#define SPHEREBVH_H
+
+#include <vector>
+#include <QAtomicInt>
+#include <QRunnable>
+#include "vector.h"
+#include "sphere.h"
+
+// Maximum number of spheres per leaf
+#define SPHERE_BVH_LEAF_SIZE 4
+
+// Degradation at which the tree is rebuilt
+#define SPHERE_BVH_REBUILD_RATIO 1.5
+
+struct SphereNode
+{
+    float boundsMin[3];
+    float boundsMax[3];
+    int index;      // Inner node: right child (the left child follows the node), leaf: first entry of the order
+    int count;      // Spheres of a leaf, 0 for inner nodes
+};
+
+class SphereBvh
+{
+public:
+    SphereBvh();
+
+    void clear();
+
+    // Build the tree over the spheres
+    void build(std::vector<sphere> &spheres);
+
+    // Build the tree over the bounding spheres: center in x, y, z and radius in w
+    void build(const std::vector<Vec4d> &bounds);
+
+    // Number of spheres the tree was built for
+    int getSphereCount();
+
+    // Update the boxes after the given spheres moved
+    void refit(std::vector<sphere> &spheres, const std::vector<int> &moved);
+
+    // Update all boxes, e.g. for a tree built from older positions
+    void refit(std::vector<sphere> &spheres);
+
+    // Surface area cost of the refit tree relative to the cost after the build, 1 when built
+    double getDegradation();
+
+    // Does the ray origin + t*dir hit any sphere but "exclude" with t > 0?
+    // Uses sphere::intersect(), tests counts the ray-sphere tests.
+    bool occluded(const Vec3d &origin, const Vec3d &dir, int exclude, std::vector<sphere> &spheres, qint64 &tests);
+
+    // Closest hit of the ray origin + t*dir with tMin < t < tMax. Returns the sphere and sets
+    // tMax to its t, -1 if there is none. Uses sphere::intersectDistance().
+    int intersect(const Vec3d &origin, const Vec3d &dir, double tMin, double &tMax, std::vector<sphere> &spheres, qint64 &tests);
+
+    void swap(SphereBvh &bvh);
+
+private:
+    // Build the subtree of the spheres m_order[first, first + count) at the given depth, returns its node
+    int buildNode(const std::vector<Vec4d> &bounds, int first, int count, int parent, int depth);
+
+    // Box of a leaf from the current positions of its spheres
+    void fitLeaf(SphereNode &node, std::vector<sphere> &spheres);
+
+    // Recompute the marked nodes from the leaves upwards and clear the marks
+    void refitMarked(std::vector<sphere> &spheres);
+
+    // Surface area of the box of a node, summed for the inner nodes by getDegradation()
+    static double area(const SphereNode &node);
+
+    // occluded() and intersect() without the tree, for trees deeper than the traversal stack
+    bool occludedAll(const Vec3d &origin, const Vec3d &dir, int exclude, std::vector<sphere> &spheres, qint64 &tests);
+    int intersectAll(const Vec3d &origin, const Vec3d &dir, double tMin, double &tMax, std::vector<sphere> &spheres, qint64 &tests);
+
+    std::vector<SphereNode> m_nodes;
+    std::vector<int> m_parents;     // Per node, -1 for the root
+    std::vector<int> m_order;       // Sphere indices, leaves hold ranges of them
+    std::vector<int> m_leaves;      // Leaf of each sphere
+    std::vector<char> m_marked;     // Per node: needs a refit
+    double m_innerArea;             // Summed surface area of the inner nodes
+    double m_builtCost;             // m_innerArea relative to the root area after the build
+    int m_depth;                    // Nodes on the longest path from the root to a leaf
+};
+
+// Builds a SphereBvh on a thread pool from a copy of the sphere bounds
+class SphereBvhBuilder : public QRunnable
+{
+public:
+    SphereBvhBuilder();
+
+    // Copy the bounds of the spheres and mark the builder as running, before it is started
+    void prepare(std::vector<sphere> &spheres);
+
+    void run();
+
+    bool isRunning();
+
+    // Swap the finished tree into bvh. Returns false if there is none.
+    bool takeResult(SphereBvh &bvh);
+
+    // Drop the finished tree, the builder must not be running
+    void discard();
+
+private:
+    enum State { IDLE, RUNNING, FINISHED };
+
+    std::vector<Vec4d> m_bounds;
+    SphereBvh m_bvh;
+    QAtomicInt m_state;
+};
+
+#endif // SPHEREBVH_H
@@ -0,0 +1,54 @@
+#include "tileworker.h"
+#include "glbox.h"
+
+TileWorker::TileWorker(GLBox *box)
+{
+    m_box = box;
+    //Workers are reused for every frame
+    setAutoDelete(false);
+    reset();
+}
+
+void TileWorker::reset()
+{
+    m_stats = RayStats();
+    for(int i=0; i<STAGE_COUNT; i++)
+    {
+        m_stageTimes[i] = 0;
+    }
+}
+
+void TileWorker::run()
+{
+    m_box->raycastTiles(*this);
+}
+
+RayStats &TileWorker::getStats()
+{
+    return m_stats;
+}
+
+qint64 *TileWorker::getStageTimes()
+{
+    return m_stageTimes;
+}
+
+std::vector<int> &TileWorker::getTileLights()
+{
+    return m_tileLights;
+}
+
+std::vector<char> &TileWorker::getTileShadows()
+{
+    return m_tileShadows;
+}
+
+std::vector<int> &TileWorker::getSampleLights()
+{
+    return m_sampleLights;
+}
+
+std::vector<char> &TileWorker::getSampleShadows()
+{
+    return m_sampleShadows;
+}
@@ -0,0 +1,51 @@
+//
+// TileWorker
+//
+// Ray casts tiles of the current frame on a thread of the tile pool of GLBox.
+// All workers take tiles from a shared atomic counter until the frame is done or
+// superseded by newer input (see GLBox::raycastTiles()). Counters and stage times
+// are collected per worker and merged once the frame is finished.
+//
+
+#ifndef TILEWORKER_H
+#define TILEWORKER_H
+
+#include <vector>
+#include <QRunnable>
+#include "profiler.h"
+
+class GLBox;
+
+class TileWorker : public QRunnable
+{
+public:
+    TileWorker(GLBox *box);
+
+    // Clear the counters and stage times for the next frame
+    void reset();
+
+    void run();
+
+    RayStats &getStats();
+
+    // Nanoseconds per ProfileStage
+    qint64 *getStageTimes();
+
+    // Scratch space reused by all tiles of the worker, so that tiles do not allocate
+    std::vector<int> &getTileLights();
+    std::vector<char> &getTileShadows();
+    std::vector<int> &getSampleLights();
+    std::vector<char> &getSampleShadows();
+
+private:
+    GLBox *m_box;
+    RayStats m_stats;
+    qint64 m_stageTimes[STAGE_COUNT];
+
+    std::vector<int> m_tileLights;      // Lights reaching the tile
+    std::vector<char> m_tileShadows;    // Per pixel and tile light: shadowed
+    std::vector<int> m_sampleLights;    // Lights reaching a single hit (see GLBox::shadeHit())
+    std::vector<char> m_sampleShadows;  // Per light of the hit: shadowed
+};
+
+#endif // TILEWORKER_H
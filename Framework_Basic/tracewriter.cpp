@@ -0,0 +1,134 @@
+#include "tracewriter.h"
+#include <QMutexLocker>
+#include <stdio.h>
+#include <string.h>
+
+TraceWriter::TraceWriter()
+{
+    m_open = 0;
+    m_first = true;
+}
+
+TraceWriter::~TraceWriter()
+{
+    close();
+}
+
+bool TraceWriter::open(QString filename)
+{
+    close();
+
+    QMutexLocker locker(&m_mutex);
+    m_file.setFileName(filename);
+    if(!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        return false;
+    }
+    m_threads.clear();
+    m_buffer.clear();
+    m_buffer.reserve(TRACE_BUFFER_SIZE);
+    m_file.write("[", 1);
+    m_first = true;
+    m_clock.start();
+    m_open = 1;
+    return true;
+}
+
+void TraceWriter::close()
+{
+    QMutexLocker locker(&m_mutex);
+    if(!m_open)
+    {
+        return;
+    }
+    m_open = 0;
+    if(!m_buffer.empty())
+    {
+        m_file.write(&m_buffer[0], m_buffer.size());
+    }
+    m_buffer.clear();
+    m_file.write("\n]\n", 3);
+    m_file.close();
+}
+
+void TraceWriter::flush()
+{
+    QMutexLocker locker(&m_mutex);
+    if(!m_open || m_buffer.empty())
+    {
+        return;
+    }
+    //clear() keeps the capacity, the next frame appends without allocating
+    m_file.write(&m_buffer[0], m_buffer.size());
+    m_buffer.clear();
+}
+
+void TraceWriter::addSpan(const char *name, qint64 start, qint64 end, const RayStats *stats, int x, int y)
+{
+    char event[640];
+    char args[448] = "";
+    if(stats)
+    {
+        snprintf(args, sizeof(args), ",\"args\":{\"x\":%d,\"y\":%d,\"primaryRays\":%lld,\"shadowRays\":%lld,"
+                 "\"sphereTests\":%lld,\"triangleTests\":%lld,\"hits\":%lld,\"textureFetches\":%lld,"
+                 "\"aaSamples\":%lld,\"refinedPixels\":%lld,\"secondaryRays\":%lld}",
+                 x, y, (long long)stats->primaryRays, (long long)stats->shadowRays, (long long)stats->sphereTests,
+                 (long long)stats->triangleTests, (long long)stats->hits, (long long)stats->textureFetches,
+                 (long long)stats->aaSamples, (long long)stats->refinedPixels, (long long)stats->secondaryRays);
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if(!m_open)
+    {
+        return;
+    }
+    snprintf(event, sizeof(event), "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f%s}",
+             name, getThreadId(), start / 1.0e3, (end - start) / 1.0e3, args);
+    write(event);
+}
+
+void TraceWriter::addCounters(const char *name, qint64 time, const RayStats &stats)
+{
+    char event[512];
+    QMutexLocker locker(&m_mutex);
+    if(!m_open)
+    {
+        return;
+    }
+    snprintf(event, sizeof(event), "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{"
+             "\"primaryRays\":%lld,\"shadowRays\":%lld,\"sphereTests\":%lld,\"triangleTests\":%lld,\"hits\":%lld,"
+             "\"textureFetches\":%lld,\"aaSamples\":%lld,\"refinedPixels\":%lld,\"secondaryRays\":%lld}}",
+             name, getThreadId(), time / 1.0e3, (long long)stats.primaryRays, (long long)stats.shadowRays,
+             (long long)stats.sphereTests, (long long)stats.triangleTests, (long long)stats.hits,
+             (long long)stats.textureFetches, (long long)stats.aaSamples, (long long)stats.refinedPixels,
+             (long long)stats.secondaryRays);
+    write(event);
+}
+
+int TraceWriter::getThreadId()
+{
+    QThread *thread = QThread::currentThread();
+    for(unsigned int i=0; i<m_threads.size(); i++)
+    {
+        if(m_threads[i] == thread)
+        {
+            return i + 1;
+        }
+    }
+
+    m_threads.push_back(thread);
+    int id = m_threads.size();
+    char event[128];
+    snprintf(event, sizeof(event), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+             id, id);
+    write(event);
+    return id;
+}
+
+void TraceWriter::write(const char *event)
+{
+    const char *separator = m_first ? "\n" : ",\n";
+    m_buffer.insert(m_buffer.end(), separator, separator + strlen(separator));
+    m_buffer.insert(m_buffer.end(), event, event + strlen(event));
+    m_first = false;
+}
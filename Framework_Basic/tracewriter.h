@@ -0,0 +1,71 @@
+//
+// TraceWriter
+//
+// Streams events in the Chrome trace event format (JSON array), to be opened in
+// chrome://tracing or Perfetto. Every thread writing events gets its own track.
+// Spans can carry the ray counters of the work they cover, so load imbalance
+// between tiles and threads is visible in the trace.
+//
+// Events are collected in memory and written by flush(), which the render thread calls
+// once per frame after the tile pool is done. Tile workers adding spans only copy them
+// into the buffer and never wait for file I/O, which would distort the recorded times.
+//
+
+#ifndef TRACEWRITER_H
+#define TRACEWRITER_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QFile>
+#include <QString>
+#include <QThread>
+#include <vector>
+#include "profiler.h"
+
+// Bytes reserved for the events of a frame, enough for a few thousand tile spans
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+class TraceWriter
+{
+public:
+    TraceWriter();
+    ~TraceWriter();
+
+    // Start a new trace file. Returns false if the file cannot be opened.
+    bool open(QString filename);
+
+    // Write the buffered events and finish the trace file
+    void close();
+
+    // Write the events collected since the last flush to the file
+    void flush();
+
+    bool isOpen() { return m_open != 0; }
+
+    // Nanoseconds since the trace was opened
+    qint64 now() { return m_clock.nsecsElapsed(); }
+
+    // Complete event on the track of the calling thread from start to end (see now()).
+    // Tiles pass their position in x, y.
+    void addSpan(const char *name, qint64 start, qint64 end, const RayStats *stats = NULL, int x = -1, int y = -1);
+
+    // Counter event with the given ray counters
+    void addCounters(const char *name, qint64 time, const RayStats &stats);
+
+private:
+    // Track of the calling thread, emits the thread name on first use. Call with m_mutex locked.
+    int getThreadId();
+
+    // Append an event to the buffer, separated from the previous one. Call with m_mutex locked.
+    void write(const char *event);
+
+    QAtomicInt m_open;
+    QElapsedTimer m_clock;
+    QMutex m_mutex;
+    QFile m_file;
+    bool m_first;   // No event written yet
+    std::vector<char> m_buffer;         // Events not yet written to the file
+    std::vector<QThread*> m_threads;    // Index + 1 is the track id
+};
+
+#endif // TRACEWRITER_H
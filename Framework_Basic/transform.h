@@ -0,0 +1,61 @@
+//
+// Transform
+//
+// Batched transformation of contiguous arrays of points by a single matrix.
+// The matrix entries are loaded once and the loops run over raw arrays, so the compiler
+// can vectorize them instead of going through Matrix::operator*(Vector) per point.
+//
+
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "vector.h"
+#include "matrix.h"
+
+// Transforms count points of "in" by "mat" and writes the results to "out".
+// "in" and "out" may point to the same array.
+template<class T, unsigned int SIZE>
+void transformPoints(const Matrix<T, SIZE> &mat, const Vector<T, SIZE> *in, Vector<T, SIZE> *out, int count)
+{
+    const T *m = mat.data();
+    for (int p = 0; p < count; p++)
+    {
+        const T *src = in[p].data();
+        T buf[SIZE];
+        for (unsigned int i = 0; i < SIZE; i++)
+        {
+            T sum = T(0);
+            for (unsigned int j = 0; j < SIZE; j++)
+                sum += m[i*SIZE + j] * src[j];
+            buf[i] = sum;
+        }
+        out[p].setData(buf);
+    }
+}
+
+// Direction (not normalized) of the primary ray through pixel (x, y) of a width x height frame.
+// The ray caster has its eye at (0, 0, focus) and looks down the negative z axis; fractional
+// pixel coordinates give the rays of anti-aliasing samples.
+inline Vec3d makePrimaryRay(double x, double y, int width, int height, double focus)
+{
+    return Vec3d(-1.0 + 2.0*(x/(width-1)), -1.0 + 2.0*(y/(height-1)), -focus);
+}
+
+// Projection of the ray caster for the rasterizer of the preview. A point on the primary ray
+// of pixel (x, y) (see makePrimaryRay()) is mapped to (x + 0.5, y + 0.5) by the perspective
+// division and the screen mapping of Rasterizer, the center of the same pixel. z is not used.
+inline Mat4d makePrimaryProjMat(int width, int height, double focus)
+{
+    //Rasterizer maps [-1, 1] to [0, width], the ray caster maps pixel 0 and width-1 to -1 and 1
+    Mat4d projMat;
+    projMat(0,0) = (width - 1) / double(width);
+    projMat(1,1) = (height - 1) / double(height);
+    projMat(3,3) = 1;
+    if(focus != 0)
+    {
+        projMat(3,2) = -1/focus;
+    }
+    return projMat;
+}
+
+#endif // TRANSFORM_H
@@ -0,0 +1,521 @@
+#include "trianglemesh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <QFile>
+
+// Maximum length of a line in an OBJ file
+#define MAX_OBJ_LINE 4096
+
+// Maximum depth of the hierarchy during traversal
+#define MESH_STACK_SIZE 64
+
+// Orders triangles by the centroid coordinate along one axis
+class CentroidLess
+{
+public:
+    CentroidLess(const std::vector<Vec3d> &centroids, int axis) : m_centroids(centroids), m_axis(axis) {}
+
+    bool operator ()(int a, int b) const
+    {
+        return m_centroids[a](m_axis) < m_centroids[b](m_axis);
+    }
+
+private:
+    const std::vector<Vec3d> &m_centroids;
+    int m_axis;
+};
+
+TriangleMesh::TriangleMesh()
+{
+    clear();
+}
+
+void TriangleMesh::clear()
+{
+    m_vertices.clear();
+    m_triangles.clear();
+    m_nodes.clear();
+    m_packets.clear();
+    m_boundsMin = Vec3d(INFINITY, INFINITY, INFINITY);
+    m_boundsMax = Vec3d(-INFINITY, -INFINITY, -INFINITY);
+}
+
+QString TriangleMesh::getError()
+{
+    return m_error;
+}
+
+int TriangleMesh::addVertex(Vec3d v)
+{
+    m_vertices.push_back(v);
+    for(int i=0; i<3; i++)
+    {
+        m_boundsMin(i) = std::min(m_boundsMin(i), v(i));
+        m_boundsMax(i) = std::max(m_boundsMax(i), v(i));
+    }
+    return m_vertices.size() - 1;
+}
+
+void TriangleMesh::addTriangle(int v1, int v2, int v3)
+{
+    m_triangles.push_back(v1);
+    m_triangles.push_back(v2);
+    m_triangles.push_back(v3);
+}
+
+int TriangleMesh::getTriangleCount()
+{
+    return m_triangles.size() / 3;
+}
+
+size_t TriangleMesh::memoryUsage()
+{
+    return m_vertices.capacity()*sizeof(Vec3d)
+            + m_triangles.capacity()*sizeof(int)
+            + m_nodes.capacity()*sizeof(MeshNode)
+            + m_packets.capacity()*sizeof(TrianglePacket);
+}
+
+Vec3d TriangleMesh::getBoundsMin()
+{
+    return m_boundsMin;
+}
+
+Vec3d TriangleMesh::getBoundsMax()
+{
+    return m_boundsMax;
+}
+
+Vec3d TriangleMesh::getNormal(int triangle)
+{
+    Vec3d v0 = m_vertices[m_triangles[3*triangle]];
+    Vec3d e1 = m_vertices[m_triangles[3*triangle+1]] - v0;
+    Vec3d e2 = m_vertices[m_triangles[3*triangle+2]] - v0;
+    return e1.cross(e2).norm();
+}
+
+bool TriangleMesh::loadObj(QString filename)
+{
+    clear();
+    m_error = QString();
+
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        m_error = "Cannot open " + filename + ": " + file.errorString();
+        return false;
+    }
+
+    char line[MAX_OBJ_LINE];
+    int lineNumber = 0;
+    while(file.readLine(line, MAX_OBJ_LINE) > 0)
+    {
+        lineNumber++;
+        char *p = line;
+        while(*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+
+        if(p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            double x, y, z;
+            if(sscanf(p + 1, "%lf %lf %lf", &x, &y, &z) != 3)
+            {
+                m_error = QString("%1: line %2: invalid vertex").arg(filename).arg(lineNumber);
+                clear();
+                return false;
+            }
+            addVertex(Vec3d(x, y, z));
+        }
+        else if(p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            //Fan around the first vertex, texture and normal indices after '/' are skipped
+            char *s = p + 1;
+            int count = 0;
+            int first = -1;
+            int previous = -1;
+            forever
+            {
+                char *end;
+                int index = int(strtol(s, &end, 10));
+                if(end == s)
+                {
+                    break;
+                }
+                int vertexCount = m_vertices.size();
+                int v = index > 0 ? index - 1 : vertexCount + index;
+                if(index == 0 || v < 0 || v >= vertexCount)
+                {
+                    m_error = QString("%1: line %2: invalid vertex index %3").arg(filename).arg(lineNumber).arg(index);
+                    clear();
+                    return false;
+                }
+                if(count == 0)
+                {
+                    first = v;
+                }
+                else if(count >= 2)
+                {
+                    addTriangle(first, previous, v);
+                }
+                previous = v;
+                count++;
+
+                s = end;
+                while(*s != '\0' && *s != ' ' && *s != '\t' && *s != '\n' && *s != '\r')
+                {
+                    s++;
+                }
+            }
+        }
+    }
+
+    build();
+    return true;
+}
+
+void TriangleMesh::build()
+{
+    m_nodes.clear();
+    m_packets.clear();
+    int count = getTriangleCount();
+    if(count == 0)
+    {
+        return;
+    }
+
+    std::vector<int> order(count);
+    std::vector<Vec3d> centroids(count);
+    for(int i=0; i<count; i++)
+    {
+        order[i] = i;
+        centroids[i] = (m_vertices[m_triangles[3*i]] + m_vertices[m_triangles[3*i+1]] + m_vertices[m_triangles[3*i+2]]) * (1.0/3.0);
+    }
+
+    m_nodes.reserve(2*(count / MESH_PACKET + 1));
+    m_packets.reserve(count / MESH_PACKET + 1);
+    buildNode(order, centroids, 0, count);
+}
+
+int TriangleMesh::buildNode(std::vector<int> &order, std::vector<Vec3d> &centroids, int first, int count)
+{
+    int node = m_nodes.size();
+    m_nodes.push_back(MeshNode());
+
+    Vec3d boundsMin(INFINITY, INFINITY, INFINITY);
+    Vec3d boundsMax(-INFINITY, -INFINITY, -INFINITY);
+    Vec3d centroidMin(INFINITY, INFINITY, INFINITY);
+    Vec3d centroidMax(-INFINITY, -INFINITY, -INFINITY);
+    for(int i=first; i<first + count; i++)
+    {
+        for(int c=0; c<3; c++)
+        {
+            const Vec3d &v = m_vertices[m_triangles[3*order[i] + c]];
+            for(int a=0; a<3; a++)
+            {
+                boundsMin(a) = std::min(boundsMin(a), v(a));
+                boundsMax(a) = std::max(boundsMax(a), v(a));
+            }
+        }
+        for(int a=0; a<3; a++)
+        {
+            centroidMin(a) = std::min(centroidMin(a), centroids[order[i]](a));
+            centroidMax(a) = std::max(centroidMax(a), centroids[order[i]](a));
+        }
+    }
+    for(int a=0; a<3; a++)
+    {
+        //Rounded outwards, so float boxes never cut off a triangle
+        m_nodes[node].boundsMin[a] = nextafterf(float(boundsMin(a)), -FLT_MAX);
+        m_nodes[node].boundsMax[a] = nextafterf(float(boundsMax(a)), FLT_MAX);
+    }
+
+    if(count <= MESH_PACKET)
+    {
+        TrianglePacket packet;
+        for(int lane=0; lane<MESH_PACKET; lane++)
+        {
+            //Unused lanes get a degenerate triangle with zero edges
+            int triangle = lane < count ? order[first + lane] : -1;
+            Vec3d v0, e1, e2;
+            if(triangle >= 0)
+            {
+                v0 = m_vertices[m_triangles[3*triangle]];
+                e1 = m_vertices[m_triangles[3*triangle+1]] - v0;
+                e2 = m_vertices[m_triangles[3*triangle+2]] - v0;
+            }
+            for(int a=0; a<3; a++)
+            {
+                packet.v0[a][lane] = float(v0(a));
+                packet.e1[a][lane] = float(e1(a));
+                packet.e2[a][lane] = float(e2(a));
+            }
+            packet.triangles[lane] = triangle;
+        }
+        m_nodes[node].index = m_packets.size();
+        m_nodes[node].leaf = 1;
+        m_packets.push_back(packet);
+        return node;
+    }
+
+    //Median split along the longest axis of the centroids
+    int axis = 0;
+    for(int a=1; a<3; a++)
+    {
+        if(centroidMax(a) - centroidMin(a) > centroidMax(axis) - centroidMin(axis))
+        {
+            axis = a;
+        }
+    }
+    int half = count / 2;
+    std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+                     CentroidLess(centroids, axis));
+
+    buildNode(order, centroids, first, half);
+    int right = buildNode(order, centroids, first + half, count - half);
+    m_nodes[node].index = right;
+    m_nodes[node].leaf = 0;
+    return node;
+}
+
+// Entry distance of the ray into the box, INFINITY if it misses it before tMax
+static inline float intersectBox(const MeshNode &node, const float origin[3], const float invDir[3], float tMin, float tMax)
+{
+    for(int a=0; a<3; a++)
+    {
+        float t0 = (node.boundsMin[a] - origin[a]) * invDir[a];
+        float t1 = (node.boundsMax[a] - origin[a]) * invDir[a];
+        tMin = std::max(tMin, std::min(t0, t1));
+        tMax = std::min(tMax, std::max(t0, t1));
+    }
+    return tMin <= tMax ? tMin : INFINITY;
+}
+
+int TriangleMesh::intersect(const Vec3d &origin, const Vec3d &dir, double tMin, double &tMax, qint64 &tests)
+{
+    return traverse(origin, dir, tMin, tMax, false, tests);
+}
+
+bool TriangleMesh::occluded(const Vec3d &origin, const Vec3d &dir, double tMin, double tMax, qint64 &tests)
+{
+    return traverse(origin, dir, tMin, tMax, true, tests) >= 0;
+}
+
+int TriangleMesh::traverse(const Vec3d &origin, const Vec3d &dir, double tMin, double &tMax, bool any, qint64 &tests)
+{
+    if(m_nodes.empty())
+    {
+        return -1;
+    }
+
+    float o[3], d[3], invDir[3];
+    for(int a=0; a<3; a++)
+    {
+        o[a] = float(origin(a));
+        d[a] = float(dir(a));
+        invDir[a] = 1.0f / d[a];
+    }
+    float nearT = float(tMin);
+    float farT = float(tMax);
+    int hitTriangle = -1;
+
+    int stack[MESH_STACK_SIZE];
+    int stackSize = 0;
+    if(intersectBox(m_nodes[0], o, invDir, nearT, farT) != INFINITY)
+    {
+        stack[stackSize++] = 0;
+    }
+
+    while(stackSize > 0)
+    {
+        const MeshNode &node = m_nodes[stack[--stackSize]];
+        if(!node.leaf)
+        {
+            //The nearer child is visited first, children behind the closest hit are skipped
+            int left = &node - &m_nodes[0] + 1;
+            int right = node.index;
+            float tLeft = intersectBox(m_nodes[left], o, invDir, nearT, farT);
+            float tRight = intersectBox(m_nodes[right], o, invDir, nearT, farT);
+            if(tLeft > tRight)
+            {
+                std::swap(left, right);
+                std::swap(tLeft, tRight);
+            }
+            if(tRight != INFINITY && stackSize < MESH_STACK_SIZE)
+            {
+                stack[stackSize++] = right;
+            }
+            if(tLeft != INFINITY && stackSize < MESH_STACK_SIZE)
+            {
+                stack[stackSize++] = left;
+            }
+            continue;
+        }
+
+        //Moeller-Trumbore for all lanes of the packet, without branches. The rows are read through
+        //restrict pointers so the compiler needs no alias checks to vectorize the loop
+        const TrianglePacket &packet = m_packets[node.index];
+        const float *__restrict v0x = packet.v0[0];
+        const float *__restrict v0y = packet.v0[1];
+        const float *__restrict v0z = packet.v0[2];
+        const float *__restrict e1x = packet.e1[0];
+        const float *__restrict e1y = packet.e1[1];
+        const float *__restrict e1z = packet.e1[2];
+        const float *__restrict e2x = packet.e2[0];
+        const float *__restrict e2y = packet.e2[1];
+        const float *__restrict e2z = packet.e2[2];
+        float t[MESH_PACKET];
+        float *__restrict tOut = t;
+        for(int i=0; i<MESH_PACKET; i++)
+        {
+            float px = d[1]*e2z[i] - d[2]*e2y[i];
+            float py = d[2]*e2x[i] - d[0]*e2z[i];
+            float pz = d[0]*e2y[i] - d[1]*e2x[i];
+            float det = e1x[i]*px + e1y[i]*py + e1z[i]*pz;
+            float invDet = 1.0f / det;  //Degenerate lanes are masked below
+
+            float sx = o[0] - v0x[i];
+            float sy = o[1] - v0y[i];
+            float sz = o[2] - v0z[i];
+            float u = (sx*px + sy*py + sz*pz) * invDet;
+
+            float qx = sy*e1z[i] - sz*e1y[i];
+            float qy = sz*e1x[i] - sx*e1z[i];
+            float qz = sx*e1y[i] - sy*e1x[i];
+            float v = (d[0]*qx + d[1]*qy + d[2]*qz) * invDet;
+            float tHit = (e2x[i]*qx + e2y[i]*qy + e2z[i]*qz) * invDet;
+
+            //& instead of && avoids branches
+            bool hit = (det != 0.0f) & (u >= 0.0f) & (v >= 0.0f) & (u + v <= 1.0f) & (tHit > nearT) & (tHit < farT);
+            tOut[i] = hit ? tHit : INFINITY;
+        }
+        tests += MESH_PACKET;
+
+        for(int i=0; i<MESH_PACKET; i++)
+        {
+            if(t[i] < farT)
+            {
+                farT = t[i];
+                hitTriangle = packet.triangles[i];
+            }
+        }
+        if(any && hitTriangle >= 0)
+        {
+            break;
+        }
+    }
+
+    if(hitTriangle >= 0)
+    {
+        tMax = farT;
+    }
+    return hitTriangle;
+}
+
+MeshInstance::MeshInstance()
+{
+    m_mesh = -1;
+}
+
+// False for NaN and infinity, whose difference with themselves is NaN
+static inline bool isFinite(double x)
+{
+    return x - x == 0;
+}
+
+MeshInstance::MeshInstance(int mesh, Mat4d transform, Material material)
+{
+    m_mesh = mesh;
+    m_transform = transform;
+    bool singular;
+    m_inverse = transform.inverse(singular);
+    m_material = material;
+
+    //Rays moved into object space by such a transform would be NaN, the instance is skipped
+    bool finite = !singular;
+    for(int i=0; i<4; i++)
+    {
+        for(int j=0; j<4; j++)
+        {
+            finite = finite && isFinite(transform(i,j)) && isFinite(m_inverse(i,j));
+        }
+    }
+    if(!finite)
+    {
+        m_mesh = -1;
+    }
+}
+
+int MeshInstance::getMesh()
+{
+    return m_mesh;
+}
+
+Material MeshInstance::getMaterial()
+{
+    return m_material;
+}
+
+void MeshInstance::updateBounds(TriangleMesh &mesh)
+{
+    //Box around the transformed corners of the mesh box
+    Vec3d meshMin = mesh.getBoundsMin();
+    Vec3d meshMax = mesh.getBoundsMax();
+    m_boundsMin = Vec3d(INFINITY, INFINITY, INFINITY);
+    m_boundsMax = Vec3d(-INFINITY, -INFINITY, -INFINITY);
+    for(int i=0; i<8; i++)
+    {
+        Vec4d corner(i & 1 ? meshMax(0) : meshMin(0), i & 2 ? meshMax(1) : meshMin(1), i & 4 ? meshMax(2) : meshMin(2), 1);
+        corner = m_transform * corner;
+        for(int a=0; a<3; a++)
+        {
+            m_boundsMin(a) = std::min(m_boundsMin(a), corner(a));
+            m_boundsMax(a) = std::max(m_boundsMax(a), corner(a));
+        }
+    }
+}
+
+bool MeshInstance::hitsBounds(const Vec3d &origin, const Vec3d &dir, double tMax)
+{
+    if(m_mesh < 0)
+    {
+        return false;
+    }
+
+    double tMin = 0;
+    for(int a=0; a<3; a++)
+    {
+        double inv = 1.0 / dir(a);
+        double t0 = (m_boundsMin(a) - origin(a)) * inv;
+        double t1 = (m_boundsMax(a) - origin(a)) * inv;
+        tMin = std::max(tMin, std::min(t0, t1));
+        tMax = std::min(tMax, std::max(t0, t1));
+    }
+    return tMin <= tMax;
+}
+
+void MeshInstance::toObject(const Vec3d &origin, const Vec3d &dir, Vec3d &objOrigin, Vec3d &objDir)
+{
+    const Mat4d &m = m_inverse;
+    for(int i=0; i<3; i++)
+    {
+        objOrigin(i) = m(i,0)*origin(0) + m(i,1)*origin(1) + m(i,2)*origin(2) + m(i,3);
+        objDir(i) = m(i,0)*dir(0) + m(i,1)*dir(1) + m(i,2)*dir(2);
+    }
+}
+
+Vec3d MeshInstance::normalToWorld(Vec3d normal)
+{
+    //Transposed inverse
+    const Mat4d &m = m_inverse;
+    Vec3d world;
+    for(int i=0; i<3; i++)
+    {
+        world(i) = m(0,i)*normal(0) + m(1,i)*normal(1) + m(2,i)*normal(2);
+    }
+    return world.norm();
+}
@@ -0,0 +1,134 @@
+//
+// TriangleMesh
+//
+// Triangle mesh for the ray caster with a bounding volume hierarchy of its own. Every leaf
+// holds up to MESH_PACKET triangles in structure-of-arrays layout (first vertex and two edges
+// per coordinate), so one ray is tested against a whole leaf by a branch free Moeller-Trumbore
+// loop the compiler vectorizes. Unused lanes hold degenerate triangles that never hit.
+//
+// A mesh is stored once and placed in the scene by any number of MeshInstance objects, which
+// transform the rays into the object space of the mesh.
+//
+
+#ifndef TRIANGLEMESH_H
+#define TRIANGLEMESH_H
+
+#include <vector>
+#include <QString>
+#include "vector.h"
+#include "matrix.h"
+#include "material.h"
+
+// Triangles tested at once, also the maximum number of triangles per leaf
+#define MESH_PACKET 8
+
+// Minimum distance of hits from the ray origin, keeps shadow rays from hitting their own surface
+#define MESH_EPSILON 1e-4
+
+// Leaf of the hierarchy, triangles in structure-of-arrays layout
+struct TrianglePacket
+{
+    float v0[3][MESH_PACKET];
+    float e1[3][MESH_PACKET];
+    float e2[3][MESH_PACKET];
+    int triangles[MESH_PACKET];     // Triangle index of each lane, -1 if unused
+};
+
+struct MeshNode
+{
+    float boundsMin[3];
+    float boundsMax[3];
+    int index;      // Inner node: right child (the left child follows the node), leaf: packet
+    int leaf;
+};
+
+class TriangleMesh
+{
+public:
+    TriangleMesh();
+
+    void clear();
+
+    // Load the "v" and "f" entries of an OBJ file, polygons are split into triangle fans.
+    // Returns false on error, see getError(). The hierarchy is built afterwards.
+    bool loadObj(QString filename);
+
+    QString getError();
+
+    int addVertex(Vec3d v);
+
+    void addTriangle(int v1, int v2, int v3);
+
+    // Build the hierarchy, required after adding triangles
+    void build();
+
+    int getTriangleCount();
+
+    // Heap memory of the vertices, triangles and the hierarchy in bytes
+    size_t memoryUsage();
+
+    Vec3d getBoundsMin();
+    Vec3d getBoundsMax();
+
+    // Closest hit of the ray origin + t*dir with tMin < t < tMax. Returns the triangle and sets
+    // tMax to its t, -1 if there is none. tests counts the ray-triangle tests.
+    int intersect(const Vec3d &origin, const Vec3d &dir, double tMin, double &tMax, qint64 &tests);
+
+    // Any hit with tMin < t < tMax, for shadow rays
+    bool occluded(const Vec3d &origin, const Vec3d &dir, double tMin, double tMax, qint64 &tests);
+
+    // Unit normal of a triangle in object space
+    Vec3d getNormal(int triangle);
+
+private:
+    // Closest hit, or any hit if "any" is set
+    int traverse(const Vec3d &origin, const Vec3d &dir, double tMin, double &tMax, bool any, qint64 &tests);
+
+    // Build the subtree of the triangles order[first, first + count), returns its node
+    int buildNode(std::vector<int> &order, std::vector<Vec3d> &centroids, int first, int count);
+
+    std::vector<Vec3d> m_vertices;
+    std::vector<int> m_triangles;   // Three vertex indices per triangle
+    std::vector<MeshNode> m_nodes;
+    std::vector<TrianglePacket> m_packets;
+    Vec3d m_boundsMin;
+    Vec3d m_boundsMax;
+    QString m_error;
+};
+
+// Placement of a shared mesh in the scene
+class MeshInstance
+{
+public:
+    MeshInstance();
+
+    // A singular or non-finite transform makes the instance invalid, it is never hit
+    MeshInstance(int mesh, Mat4d transform, Material material);
+
+    // Index of the mesh in the scene, -1 if the instance is invalid
+    int getMesh();
+
+    Material getMaterial();
+
+    // Update the world space bounding box from the mesh
+    void updateBounds(TriangleMesh &mesh);
+
+    // Does the ray origin + t*dir hit the bounding box with t < tMax? False if the instance is invalid.
+    bool hitsBounds(const Vec3d &origin, const Vec3d &dir, double tMax);
+
+    // Ray in object space, t stays the same since the direction is not normalized
+    void toObject(const Vec3d &origin, const Vec3d &dir, Vec3d &objOrigin, Vec3d &objDir);
+
+    // Object space normal to a unit world space normal
+    Vec3d normalToWorld(Vec3d normal);
+
+private:
+    int m_mesh;
+    Mat4d m_transform;
+    Mat4d m_inverse;
+    Material m_material;
+    Vec3d m_boundsMin;
+    Vec3d m_boundsMax;
+};
+
+#endif // TRIANGLEMESH_H
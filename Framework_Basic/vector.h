@@ -92,6 +92,17 @@ public:
         return SIZE;
     }
 
+    // Direct access to the underlying array, e.g. for batched processing of contiguous vectors.
+    T *data()
+    {
+        return m_data;
+    }
+
+    const T *data() const
+    {
+        return m_data;
+    }
+
     // Assignment operator
     Vector<T, SIZE> &operator =(const Vector<T, SIZE> &vec)
     {